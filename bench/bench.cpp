@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "heap.h"
+
+// Compares allocate/deallocate against the system malloc/free on synthetic
+// workloads. Every (workload, allocator) pair runs twice, each time in a fresh
+// child process so peak RSS is not shared between runs:
+//   - a throughput run with no per-op timing, for ns/op and peak RSS
+//   - a latency run that times every call, for p50/p99 and peak live bytes
+// Fragmentation is peak RSS growth divided by peak live requested bytes.
+
+using Clock = std::chrono::steady_clock;
+
+struct Allocator {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+};
+
+static void* markov_alloc(size_t size) { return allocate(size); }
+static void markov_free(void* ptr) { deallocate(ptr); }
+
+static const Allocator ALLOCATORS[] = {
+    {"markov", markov_alloc, markov_free},
+    {"malloc", malloc, free},
+};
+
+// xorshift64*, so both allocators see identical request streams
+struct Rng {
+    uint64_t state;
+    explicit Rng(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+    // Log-uniform in [lo, hi], like real size distributions
+    size_t size(size_t lo, size_t hi) {
+        int lo_bits = 63 - __builtin_clzll(lo);
+        int hi_bits = 63 - __builtin_clzll(hi);
+        int bits = lo_bits + static_cast<int>(next() % (hi_bits - lo_bits + 1));
+        size_t size = (size_t(1) << bits) + next() % (size_t(1) << bits);
+        return std::clamp(size, lo, hi);
+    }
+};
+
+std::atomic<int64_t> live_bytes{0};
+std::atomic<int64_t> peak_live{0};
+
+// Per-thread measurement state. Latency samples are reserved up front so the
+// bookkeeping does not allocate while the workload runs.
+struct Recorder {
+    const Allocator* a;
+    bool timed;
+    std::vector<uint32_t> samples;
+    uint64_t ops = 0;
+
+    void* alloc(size_t size) {
+        ++ops;
+        if (!timed) return a->alloc(size);
+
+        auto start = Clock::now();
+        void* p = a->alloc(size);
+        samples.push_back(static_cast<uint32_t>((Clock::now() - start).count()));
+
+        int64_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        int64_t peak = peak_live.load(std::memory_order_relaxed);
+        while (live > peak && !peak_live.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        return p;
+    }
+
+    void release(void* p, size_t size) {
+        ++ops;
+        if (!timed) return a->release(p);
+
+        auto start = Clock::now();
+        a->release(p);
+        samples.push_back(static_cast<uint32_t>((Clock::now() - start).count()));
+        live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+struct Slot {
+    void* p;
+    size_t size;
+};
+
+// A fixed sequence of sizes allocated and freed in rounds: the pattern the
+// Markov predictor is built for.
+static void repeating(std::vector<Recorder>& rec) {
+    const size_t pattern[] = {16, 32, 64, 24, 100, 8, 48, 256};
+    Slot live[8];
+    for (int round = 0; round < 150000; ++round) {
+        for (int i = 0; i < 8; ++i) live[i] = {rec[0].alloc(pattern[i]), pattern[i]};
+        for (int i = 0; i < 8; ++i) rec[0].release(live[i].p, live[i].size);
+    }
+}
+
+// Random sizes replacing random slots of a large live set
+static void random_sizes(std::vector<Recorder>& rec) {
+    constexpr int SLOTS = 10000;
+    std::vector<Slot> slots(SLOTS, Slot{nullptr, 0});
+    Rng rng(1);
+    for (int i = 0; i < 1000000; ++i) {
+        Slot& s = slots[rng.next() % SLOTS];
+        if (s.p != nullptr) rec[0].release(s.p, s.size);
+        s.size = rng.size(8, 8192);
+        s.p = rec[0].alloc(s.size);
+    }
+    for (Slot& s : slots) {
+        if (s.p != nullptr) rec[0].release(s.p, s.size);
+    }
+}
+
+// One thread allocates, another frees, through a bounded single-producer
+// single-consumer ring, so every block is freed by a foreign thread.
+static void producer_consumer(std::vector<Recorder>& rec) {
+    constexpr int ITEMS = 500000;
+    constexpr size_t RING = 1024;
+    static Slot ring[RING];
+    std::atomic<size_t> head{0}, tail{0};
+
+    std::thread producer([&] {
+        Rng rng(2);
+        for (int i = 0; i < ITEMS; ++i) {
+            size_t size = rng.size(16, 1024);
+            void* p = rec[0].alloc(size);
+            size_t h = head.load(std::memory_order_relaxed);
+            while (h - tail.load(std::memory_order_acquire) == RING) std::this_thread::yield();
+            ring[h % RING] = {p, size};
+            head.store(h + 1, std::memory_order_release);
+        }
+    });
+    std::thread consumer([&] {
+        for (int i = 0; i < ITEMS; ++i) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            while (head.load(std::memory_order_acquire) == t) std::this_thread::yield();
+            Slot s = ring[t % RING];
+            tail.store(t + 1, std::memory_order_release);
+            rec[1].release(s.p, s.size);
+        }
+    });
+    producer.join();
+    consumer.join();
+}
+
+// Larson-style server churn: each thread replaces random objects in its own
+// set, and periodically trades the set for the one last traded in by another
+// thread, whose objects it then frees.
+static void larson(std::vector<Recorder>& rec) {
+    constexpr int THREADS = 4;
+    constexpr int SLOTS = 1000;
+    constexpr int OPS = 200000;
+    constexpr int EXCHANGE_EVERY = 10000;
+
+    std::vector<std::vector<Slot>> sets(THREADS + 1, std::vector<Slot>(SLOTS, Slot{nullptr, 0}));
+    std::vector<Slot>& spare = sets[THREADS];
+    std::mutex exchange_lock;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            Rng rng(3 + t);
+            std::vector<Slot>& mine = sets[t];
+            for (int i = 1; i <= OPS; ++i) {
+                Slot& s = mine[rng.next() % SLOTS];
+                if (s.p != nullptr) rec[t].release(s.p, s.size);
+                s.size = rng.size(16, 512);
+                s.p = rec[t].alloc(s.size);
+
+                if (i % EXCHANGE_EVERY == 0) {
+                    std::lock_guard<std::mutex> guard(exchange_lock);
+                    mine.swap(spare);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (std::vector<Slot>& set : sets) {
+        for (Slot& s : set) {
+            if (s.p != nullptr) rec[0].release(s.p, s.size);
+        }
+    }
+}
+
+struct Workload {
+    const char* name;
+    void (*run)(std::vector<Recorder>&);
+    int recorders;
+    size_t ops_hint;  // latency samples to reserve per recorder
+};
+
+static const Workload WORKLOADS[] = {
+    {"repeating", repeating, 1, 2400000},
+    {"random", random_sizes, 1, 2100000},
+    {"prodcons", producer_consumer, 2, 500000},
+    {"larson", larson, 4, 402000},
+};
+
+struct Result {
+    double ns_per_op;
+    double p50;
+    double p99;
+    long peak_rss_kb;
+    int64_t peak_live;
+};
+
+static long read_status_kb(const char* field) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f == nullptr) return 0;
+    char line[256];
+    long kb = 0;
+    size_t n = strlen(field);
+    while (fgets(line, sizeof line, f) != nullptr) {
+        if (strncmp(line, field, n) == 0) {
+            kb = atol(line + n + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Resets VmHWM to the current RSS so the child measures only its own growth
+static void reset_peak_rss() {
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f == nullptr) return;
+    fputs("5", f);
+    fclose(f);
+}
+
+static Result measure(const Workload& w, const Allocator& a, bool timed) {
+    std::vector<Recorder> rec(w.recorders, Recorder{&a, timed, {}, 0});
+    if (timed) {
+        for (Recorder& r : rec) r.samples.reserve(w.ops_hint);
+    }
+
+    reset_peak_rss();
+    long base_rss = read_status_kb("VmRSS:");
+    auto start = Clock::now();
+    w.run(rec);
+    double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    Result result{};
+    result.peak_rss_kb = read_status_kb("VmHWM:") - base_rss;
+
+    uint64_t ops = 0;
+    for (Recorder& r : rec) ops += r.ops;
+    // Threads run concurrently, so ns/op is wall time per op per thread
+    result.ns_per_op = elapsed * w.recorders / ops;
+
+    if (timed) {
+        std::vector<uint32_t> all;
+        for (Recorder& r : rec) all.insert(all.end(), r.samples.begin(), r.samples.end());
+        auto pct = [&](double q) {
+            size_t k = static_cast<size_t>(q * (all.size() - 1));
+            std::nth_element(all.begin(), all.begin() + k, all.end());
+            return static_cast<double>(all[k]);
+        };
+        result.p50 = pct(0.50);
+        result.p99 = pct(0.99);
+        result.peak_live = peak_live.load();
+    }
+    return result;
+}
+
+// Runs one measurement in a child process and returns its result
+static bool run_isolated(const Workload& w, const Allocator& a, bool timed, Result& out) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result r = measure(w, a, timed);
+        ssize_t written = write(fds[1], &r, sizeof r);
+        _exit(written == sizeof r ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], &out, sizeof out);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return got == sizeof out && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+    // Optional filter: only run workloads whose name matches argv[1]
+    const char* only = argc > 1 ? argv[1] : nullptr;
+
+    auto start = Clock::now();
+    for (int i = 0; i < 1000; ++i) Clock::now();
+    double clock_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / 1000;
+
+    printf("=== Allocator Benchmark ===\n");
+    printf("Latencies include about %.0f ns of clock overhead per sample.\n\n", clock_ns);
+    printf("%-10s %-7s %8s %8s %8s %12s %8s\n", "workload", "alloc", "ns/op", "p50", "p99", "peakRSS(KB)", "frag");
+
+    for (const Workload& w : WORKLOADS) {
+        if (only != nullptr && strcmp(only, w.name) != 0) continue;
+        for (const Allocator& a : ALLOCATORS) {
+            Result fast{}, timed{};
+            if (!run_isolated(w, a, false, fast) || !run_isolated(w, a, true, timed)) {
+                printf("%-10s %-7s failed\n", w.name, a.name);
+                continue;
+            }
+            double frag = timed.peak_live > 0 ? fast.peak_rss_kb * 1024.0 / timed.peak_live : 0.0;
+            printf("%-10s %-7s %8.1f %8.0f %8.0f %12ld %8.2f\n", w.name, a.name, fast.ns_per_op,
+                   timed.p50, timed.p99, fast.peak_rss_kb, frag);
+        }
+    }
+    return 0;
+}
@@ -3,12 +3,17 @@
 #include <cstring>
 #include <cstdio>
 #include "heap.h"
+#include "trace.h"
 
 int main() {
     std::cout << "=== Markov-Guided Heap Allocator Demo ===\n\n";
     
     // Initialize the heap
-    initHeap();
+    if (!initHeap()) {
+        std::cerr << "mmap failed to initialize heap\n";
+        return 1;
+    }
+    std::cout << "heap successfully initialized\n";
     std::cout << "\n--- Phase 1: Initial allocations ---\n";
     
     // Allocate some memory blocks
@@ -97,6 +102,16 @@ int main() {
     std::cout << "\n--- Final heap state ---\n";
     print_heap();
     
+    if (TRACE_ENABLED) {
+        std::vector<TraceRecord> records(TRACE_CAPACITY);
+        size_t count = trace_snapshot(records.data(), records.size());
+        std::cout << "\n--- Trace (last " << count << " events) ---\n";
+        for (size_t i = 0; i < count; ++i) {
+            std::cout << trace_event_name(records[i].event)
+                      << " a=" << records[i].a << " b=" << records[i].b << "\n";
+        }
+    }
+
     std::cout << "\nDemo completed! The Markov predictor learned the allocation pattern\n";
     std::cout << "and should have cached blocks for faster reuse.\n";
     
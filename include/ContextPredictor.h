@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include "MarkovPredictor.h"
+
+// Predicts the next size class from an arbitrary 64-bit context, such as the
+// last few classes or a caller-supplied tag. Contexts live in a fixed-size,
+// direct-mapped table, so memory stays bounded however many contexts a
+// workload produces. Each entry tracks its WAYS most frequent successors with
+// space-saving counts, halved when one reaches saturate_at. Context 0 means
+// "no context" and is never stored.
+template <class ClassMap, int TableSize = 256>
+class BasicContextPredictor {
+public:
+    static_assert((TableSize & (TableSize - 1)) == 0, "TableSize must be a power of two");
+
+    using Classes = ClassMap;
+    static constexpr int TABLE_SIZE = TableSize;
+    static constexpr int WAYS = 4;
+
+    explicit BasicContextPredictor(uint16_t saturate_at = UINT16_MAX);
+    void update(uint64_t context, int to);
+    // Most likely successor of `context`, or -1 if it is not in the table
+    int predict(uint64_t context) const;
+    // Same contract as BasicMarkovPredictor::predict_top
+    int predict_top(uint64_t context, int k, int* states, float* probs) const;
+
+    // Table slots, for reporting. An empty slot holds context 0.
+    uint64_t context_at(int slot) const { return table[slot].context; }
+    PredictionStats stats_at(int slot) const { return table[slot].stats; }
+
+private:
+    struct Entry {
+        uint64_t context;
+        uint8_t state[WAYS];
+        uint16_t count[WAYS];
+        PredictionStats stats;
+    };
+
+    Entry table[TableSize] = {};
+    uint16_t saturate_at;
+
+    static int slot_of(uint64_t context);
+    const Entry* find(uint64_t context) const;
+};
+
+extern template class BasicContextPredictor<DefaultSizeClasses>;
+
+using ContextPredictor = BasicContextPredictor<DefaultSizeClasses>;
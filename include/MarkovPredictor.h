@@ -1,19 +1,75 @@
 #pragma once
 
-#include <Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+#include "SizeClass.h"
 
-class MarkovPredictor {
+// How well a predictor has done from one context
+struct PredictionStats {
+    uint32_t predictions;  // transitions observed from the context
+    uint32_t hits;         // of those, how many went to the predicted class
+};
+
+// First-order Markov model over allocation size classes. Transitions are kept
+// as integer counts, and each row tracks its most frequent successor as counts
+// change, so update() and predict() are both O(1). States are ClassMap
+// indices; anything outside [0, MATRIX_SIZE) is ignored.
+template <class ClassMap>
+class BasicMarkovPredictor {
 public:
-    MarkovPredictor();
+    using Classes = ClassMap;
+
+    // When a counter reaches saturate_at, its whole row is halved before the
+    // increment. Ratios are kept, counts never overflow, and older history
+    // decays. The default effectively never triggers.
+    explicit BasicMarkovPredictor(uint32_t saturate_at = UINT32_MAX);
     void update(int from, int to);
     int predict(int from) const;
+    // Whether any transition out of `from` is counted. Until one is, predict()
+    // just returns `from`.
+    bool trained(int from) const;
+    // Writes up to k most likely successors of `from` (most likely first) and
+    // their probabilities; returns how many were written.
+    int predict_top(int from, int k, int* states, float* probs) const;
+    PredictionStats stats(int from) const;
+
+    static constexpr int MATRIX_SIZE = ClassMap::NUM_CLASSES;
+    static_assert(MATRIX_SIZE <= 256, "best[] stores states as uint8_t");
+
+    // Snapshots of the counts, for starting a later process warm. A snapshot
+    // is a 16-byte header (magic, SNAPSHOT_VERSION, number of classes), the
+    // class sizes as uint64_t, then the count matrix row by row as uint32_t,
+    // all in the machine's byte order, so a mapped file can be read in place.
+    // Favourites and totals are rebuilt from the counts; hit statistics are
+    // not kept.
+    static constexpr uint32_t SNAPSHOT_VERSION = 1;
+    static constexpr size_t SNAPSHOT_SIZE = 16 + MATRIX_SIZE * sizeof(uint64_t) + MATRIX_SIZE * MATRIX_SIZE * sizeof(uint32_t);
+
+    // Writes a snapshot to path, replacing any file there in one step; returns
+    // false if it cannot be written.
+    bool save(const char* path) const;
+    // Replaces the counts with a snapshot's, read from path or from size bytes
+    // at data. Returns false and changes nothing if the snapshot is short or
+    // was written by another version or for another class map. Counts at or
+    // above saturate_at are halved, row by row, until they are below it.
+    bool load(const char* path);
+    bool load(const void* data, size_t size);
+    // Whether size bytes at data hold a snapshot load() would accept
+    static bool check_snapshot(const void* data, size_t size);
 
 private:
-    static constexpr int MATRIX_SIZE = 8;  // Match markov-allocator-master
-    Eigen::Matrix<float, MATRIX_SIZE, MATRIX_SIZE> count;
-    Eigen::Matrix<float, MATRIX_SIZE, MATRIX_SIZE> transition;
-    
+    uint32_t count[MATRIX_SIZE][MATRIX_SIZE] = {};
+    uint32_t row_total[MATRIX_SIZE] = {};
+    uint8_t best[MATRIX_SIZE] = {};
+    PredictionStats row_stats[MATRIX_SIZE] = {};
+    uint32_t saturate_at;
+
     void update_count(int old_state, int new_state);
-    void update_transition(int row);
+    void decay_row(int row);
 };
 
+// Instantiated in MarkovPredictor.cpp for the maps in SizeClass.h
+extern template class BasicMarkovPredictor<DefaultSizeClasses>;
+extern template class BasicMarkovPredictor<PowerOfTwoClasses>;
+
+using MarkovPredictor = BasicMarkovPredictor<DefaultSizeClasses>;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "ContextPredictor.h"
+#include "MarkovPredictor.h"
+
+// Longest class history a prediction context can cover; one byte per class
+constexpr int MAX_PREDICTOR_ORDER = 4;
+
+// Predictor counts are halved once one reaches this, so they cover the last
+// few dozen transitions out of each class and follow a workload's phases.
+constexpr uint32_t PREDICTOR_SATURATION = 64;
+
+// Where set_prediction_threshold starts
+constexpr float DEFAULT_PREDICTION_THRESHOLD = 0.25f;
+
+// The class a model names for the next allocation. A guess is informed when
+// it comes from a context entry or a counted row; otherwise (a huge class,
+// say) it is just the previous class.
+struct Prediction {
+    int state;
+    bool informed;
+};
+
+// What the next size class is predicted from. Every heap thread has one;
+// memory resources may own more, one per allocation stream. Header-only so
+// that tools/replay.cpp steps recorded threads through the very same code.
+struct PredictionModel {
+    MarkovPredictor predictor{PREDICTOR_SATURATION};
+    ContextPredictor contexts{PREDICTOR_SATURATION};
+    int prev_class = -1;
+    uint64_t history = 0;  // recent classes + 1, one byte each, newest lowest
+    uint64_t context = 0;  // key into contexts; 0 when predicting first-order
+
+    // The next class from the current context, falling back to the
+    // first-order matrix. state is -1 before the first allocation.
+    Prediction predict() const {
+        if (prev_class == -1) return {-1, false};
+        int predicted = context != 0 ? contexts.predict(context) : -1;
+        if (predicted >= 0) return {predicted, true};
+        return {predictor.predict(prev_class), predictor.trained(prev_class)};
+    }
+
+    // Top-k successors of the current context, with the same fallback
+    int predict_top(int k, int* states, float* probs) const {
+        if (prev_class < 0) return 0;
+        if (context != 0) {
+            int n = contexts.predict_top(context, k, states, probs);
+            if (n > 0) return n;
+        }
+        return predictor.predict_top(prev_class, k, states, probs);
+    }
+
+    // Learns an allocation of class c under tag ctx and moves the context past
+    // it. The first-order matrix always learns; the context table learns only
+    // while a longer history (order > 1) or a tag is in use.
+    void observe(int c, int order, uint32_t ctx) {
+        if (prev_class != -1) predictor.update(prev_class, c);
+        if (context != 0) contexts.update(context, c);
+        follow(c, order, ctx);
+    }
+
+    // Moves the context past an allocation of class c without learning from
+    // it, so the next transition observed is still a real one
+    void follow(int c, int order, uint32_t ctx) {
+        prev_class = c;
+        history = history << 8 | static_cast<uint64_t>(c + 1);
+
+        if (order <= 1 && ctx == 0) {
+            context = 0;
+        } else {
+            uint64_t mask = order >= MAX_PREDICTOR_ORDER ? 0xffffffff : (uint64_t(1) << 8 * std::max(order, 1)) - 1;
+            context = (history & mask) | static_cast<uint64_t>(ctx) << 32;
+        }
+    }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace size_class_detail {
+
+// log2 of the spacing between classes in the octave [2^k, 2^(k+1))
+constexpr int step_shift(int k, size_t steps, size_t align) {
+    int s = k - std::countr_zero(steps);
+    int a = std::countr_zero(align);
+    return s > a ? s : a;
+}
+
+// Index of the class of size 2^k
+constexpr int octave_first(int k, int min_shift, size_t steps, size_t align) {
+    int index = 0;
+    for (int o = min_shift; o < k; ++o) index += 1 << (o - step_shift(o, steps, align));
+    return index;
+}
+
+} // namespace size_class_detail
+
+// Maps request sizes onto a fixed set of size classes, tcmalloc style: each
+// power-of-two octave from MinSize to MaxSize is split into StepsPerDouble
+// equal steps, but never finer than Align. The heap's pools and free lists and
+// the Markov predictor all index by these classes, so they always agree.
+template <size_t MinSize, size_t MaxSize, size_t StepsPerDouble, size_t Align>
+struct SizeClassMap {
+    static_assert(std::has_single_bit(MinSize) && std::has_single_bit(MaxSize) && MinSize <= MaxSize);
+    static_assert(std::has_single_bit(StepsPerDouble) && std::has_single_bit(Align));
+    static_assert(MinSize % Align == 0);
+
+    static constexpr size_t MIN_SIZE = MinSize;
+    static constexpr size_t MAX_SIZE = MaxSize;
+
+private:
+    static constexpr int MIN_SHIFT = std::countr_zero(MinSize);
+    static constexpr int MAX_SHIFT = std::countr_zero(MaxSize);
+
+    static constexpr std::array<uint8_t, 64> SHIFT = [] {
+        std::array<uint8_t, 64> shift{};
+        for (int k = MIN_SHIFT; k < 64; ++k) shift[k] = size_class_detail::step_shift(k, StepsPerDouble, Align);
+        return shift;
+    }();
+
+    static constexpr std::array<int, 64> FIRST = [] {
+        std::array<int, 64> first{};
+        for (int k = MIN_SHIFT; k <= MAX_SHIFT; ++k) first[k] = size_class_detail::octave_first(k, MIN_SHIFT, StepsPerDouble, Align);
+        return first;
+    }();
+
+public:
+    static constexpr int NUM_CLASSES = size_class_detail::octave_first(MAX_SHIFT, MIN_SHIFT, StepsPerDouble, Align) + 1;
+
+private:
+    static constexpr std::array<size_t, NUM_CLASSES> SIZES = [] {
+        std::array<size_t, NUM_CLASSES> sizes{};
+        int c = 0;
+        for (int k = MIN_SHIFT; k < MAX_SHIFT; ++k) {
+            for (size_t s = size_t(1) << k; s < size_t(2) << k; s += size_t(1) << SHIFT[k]) sizes[c++] = s;
+        }
+        sizes[c] = MaxSize;
+        return sizes;
+    }();
+
+public:
+    // Smallest class at least `size` bytes; NUM_CLASSES if size > MaxSize
+    static constexpr int class_of(size_t size) {
+        if (size <= MinSize) return 0;
+        if (size > MaxSize) return NUM_CLASSES;
+        int k = std::bit_width(size - 1) - 1;  // 2^k < size <= 2^(k+1)
+        size_t step = size_t(1) << SHIFT[k];
+        return FIRST[k] + static_cast<int>((size - (size_t(1) << k) + step - 1) >> SHIFT[k]);
+    }
+
+    // Largest class no bigger than `size`; -1 if size < MinSize
+    static constexpr int floor_class(size_t size) {
+        if (size < MinSize) return -1;
+        if (size >= MaxSize) return NUM_CLASSES - 1;
+        int k = std::bit_width(size) - 1;      // 2^k <= size < 2^(k+1)
+        return FIRST[k] + static_cast<int>((size - (size_t(1) << k)) >> SHIFT[k]);
+    }
+
+    static constexpr size_t class_size(int c) {
+        return SIZES[c];
+    }
+};
+
+// Four classes per power of two from 16 bytes to 256 KB, in steps of at least
+// 16 bytes to match the heap's alignment
+using DefaultSizeClasses = SizeClassMap<16, 256 * 1024, 4, 16>;
+
+// The original log2(bit_ceil(size)) classes, 1 to 128 bytes
+using PowerOfTwoClasses = SizeClassMap<1, 128, 1, 1>;
+
+static_assert(DefaultSizeClasses::class_of(17) == 1 && DefaultSizeClasses::class_size(1) == 32);
+static_assert(DefaultSizeClasses::class_size(DefaultSizeClasses::class_of(72)) == 80);
+static_assert(DefaultSizeClasses::floor_class(100) == DefaultSizeClasses::class_of(96));
+static_assert(PowerOfTwoClasses::NUM_CLASSES == 8 && PowerOfTwoClasses::class_of(100) == 7);
@@ -1,14 +1,174 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include "SizeClass.h"
 
-void initHeap();
+// Maps every shard's primary arena up front; returns false if mmap failed.
+// Optional, since shards map arenas on demand. Never writes any output, so it
+// is safe to run before stdio is ready.
+bool initHeap();
 void* allocate(size_t size);
+// Same as allocate(size), but ctx (e.g. a call-site id) becomes part of the
+// context the next allocation is predicted from. 0 means no tag.
+void* allocate(size_t size, uint32_t ctx);
+// Prediction state for one allocation stream: the size-class predictors and
+// the recent history they predict from. Every thread has its own; creating
+// more lets separate streams (say, a container's nodes and another's buffer)
+// each learn their own pattern. A model must not be used by two threads at
+// once. create_prediction_model returns nullptr if out of memory.
+struct PredictionModel;
+PredictionModel* create_prediction_model();
+void destroy_prediction_model(PredictionModel* model);
+// Same as allocate(size), but the block is predicted from, and teaches, model
+// instead of the thread's own. The thread's pools are refilled for what model
+// expects next.
+void* allocate(size_t size, PredictionModel& model);
 void deallocate(void* ptr);
+// Like allocate(size), for a payload aligned to `alignment`, which must be a
+// power of two; returns nullptr otherwise. allocate() already aligns to 16
+// bytes. The block is cut so its payload lands on the alignment, and the
+// slack in front of it goes back to the free lists, so it can be freed with
+// deallocate() like any other block.
+void* aligned_allocate(size_t size, size_t alignment);
+// Same as deallocate(ptr), for callers that know the size they asked for; it
+// must be the size passed to allocate or reallocate for this block.
+void deallocate_sized(void* ptr, size_t size);
+// Allocates n blocks of the same size into out[] and returns how many it got,
+// fewer than n only when memory runs out. The predictors see the batch as one
+// allocation, and the blocks a thread's pools cannot supply are carved under
+// one lock, in runs cut from as few free blocks as possible.
+size_t allocate_batch(size_t size, size_t n, void** out);
+// Frees n blocks (null entries are skipped). The pools are offered the blocks
+// against a single prediction, and the rest go back to their shards together,
+// coalescing as they are freed.
+void deallocate_batch(void** ptrs, size_t n);
+// Resizes the block at ptr, keeping its contents up to the smaller size, and
+// returns its new address. Shrinking splits the block in place and growing
+// absorbs a free block that follows it; only when neither works are the
+// contents copied to a new block. The predictor is not updated, since a
+// resize is not a new allocation. As with realloc, a null ptr allocates, a
+// size of 0 frees and returns nullptr, and on failure nullptr is returned and
+// ptr is left alone.
+void* reallocate(void* ptr, size_t size);
+// Walks and prints every block, taking each shard's lock. For debugging; use
+// get_heap_stats() for monitoring.
 void print_heap();
 
+// Upper bound on bytes held in the predictive per-class pools
+void set_cache_budget(size_t bytes);
+
+// Predicted classes less likely than min_probability (0.25 by default) get no
+// pool, so frees are not held back for sizes that rarely come next.
+void set_prediction_threshold(float min_probability);
+
+// On by default: every few thousand allocations each thread checks that at
+// least a quarter of them hit its pools. If not, it stops pooling, and frees
+// and misses go straight to the shards, until its predictor, which keeps
+// learning, names that share of the allocations correctly again. Turning this
+// off keeps every thread pooling.
+void set_adaptive_caching(bool adaptive);
+
+// Allocations whose block, the request plus its 8-byte header, is at least
+// `bytes` (512 KB by default, and never below the largest size class) get an
+// mmap of their own instead of space in an arena. Mappings of 2 MB and more
+// are 2 MB aligned and advised to use transparent huge pages. A few freed
+// mappings are cached, so freeing and reallocating large buffers does not
+// go to the kernel each time.
+void set_huge_threshold(size_t bytes);
+
+// Number of previous size classes (1-4) the next one is predicted from. Order 1
+// uses the first-order matrix; longer histories and allocate(size, ctx) tags
+// go through a fixed-size hashed context table per thread, which falls back to
+// the matrix for contexts it has not seen.
+void set_predictor_order(int order);
+
+// Warm start. save_prediction_profile writes the first-order counts of the
+// calling thread's model, or of model, to a small snapshot file; it returns
+// false if the file cannot be written. load_prediction_profile maps such a
+// file, possibly written by an earlier run or another machine, and the calling
+// thread and every thread started after it begin with its counts instead of
+// none. It returns false, changing nothing, if the file is missing or was
+// written by another snapshot version or for another size class map. The
+// preload library loads $MARKOV_PROFILE at startup and, at exit, saves the
+// counts of the thread that exits the process to $MARKOV_PROFILE_SAVE.
+bool save_prediction_profile(const char* path, const PredictionModel* model = nullptr);
+bool load_prediction_profile(const char* path);
+
+// Prediction accuracy of one context on the calling thread. The context packs
+// the previous classes as class + 1, one byte each with the newest lowest, and
+// the ctx tag in the high 32 bits. First-order rows appear with just one byte.
+struct ContextHitRate {
+    uint64_t context;
+    uint32_t predictions;  // allocations that followed this context
+    uint32_t hits;         // of those, how many were of the predicted class
+};
+
+// Copies up to n contexts, most used first, and returns how many were copied.
+// Reads model instead of the calling thread's when one is given.
+size_t context_hit_rates(ContextHitRate* out, size_t n, const PredictionModel* model = nullptr);
+
+// Size classes in HeapStats; the last entry counts requests larger than every
+// class.
+constexpr int STATS_CLASSES = DefaultSizeClasses::NUM_CLASSES + 1;
+
+// Allocator-wide counters. Gathered from per-thread and per-shard counters
+// without locks or heap walks, so each field is exact but fields may be read
+// at slightly different moments.
+struct HeapStats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t cache_hits[STATS_CLASSES];    // served from a predictive pool
+    uint64_t cache_misses[STATS_CLASSES];  // served from a shard
+    uint64_t predictions;                  // transitions the predictor was asked about
+    uint64_t prediction_hits;              // of those, how many it named correctly
+    size_t bytes_in_use;                   // block bytes handed out and not yet freed
+    size_t pooled_bytes;                   // block bytes held in the pools
+    size_t free_bytes;                     // on the shards' free lists
+    size_t largest_free_block;
+    size_t free_fragments;                 // blocks on the free lists
+    uint64_t coalesces;                    // merges of neighbouring free blocks
+    size_t mapped_bytes;                   // arenas currently mapped
+    size_t parked_bytes;                   // freed blocks waiting for a deferred merge
+};
+
+HeapStats get_heap_stats();
+
+// Writes get_heap_stats() as a JSON object into buf, truncating at size, and
+// returns the full length like snprintf.
+size_t heap_stats_json(char* buf, size_t size);
+
 // Enhanced coalescing functions
 void coalesce_one(char* block);
 void coalesce_clean();
 
+// How a shard chooses among the free blocks that fit a request. Free blocks
+// sit in bins by size, and a bitmap of the non-empty bins finds the first one
+// that can serve a request with a count-trailing-zeros.
+enum class PlacementPolicy {
+    SegregatedFit,  // the most recently freed block of that bin (default)
+    BestFit,        // the smallest fitting block near the front of that bin
+    AddressOrdered, // the lowest-addressed fitting block; bins are kept sorted
+};
+
+// Best fit and address order leave fewer slivers; address order pays for it
+// with a sorted insert on every free. Switching to it sorts the free lists.
+void set_placement_policy(PlacementPolicy policy);
+
+// Deferred coalescing, off by default. When on, a freed block is parked on a
+// per-class list of its shard instead of being merged with its neighbours, and
+// the next request of that class takes it back as is. Parked blocks are merged
+// a bounded batch at a time: every few dozen frees on the freeing thread, or by
+// the background thread below when it runs. Nothing on a request thread ever
+// walks a whole shard while this is on. Turning it off merges everything
+// parked.
+void set_deferred_coalescing(bool deferred);
+
+// Starts a thread that merges parked blocks every interval_ms, skipping shards
+// that are busy. Returns false if one is already running or it cannot start.
+bool start_background_coalescing(unsigned interval_ms);
+// Stops the thread, waiting out its current interval. Frees then merge on the
+// freeing thread again.
+void stop_background_coalescing();
+
 
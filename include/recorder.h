@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in recorder that captures every allocate/deallocate/reallocate call to a binary
+// file for offline replay (see tools/replay.cpp). Each thread appends to its
+// own buffer; full buffers are written out by a background thread, so the
+// calling thread never performs I/O. When no recording is running the cost is
+// one relaxed load per call.
+//
+// File layout: a RecordFileHeader followed by AllocRecords. Records from
+// different threads are not interleaved in order; sort by timestamp.
+
+// A reallocate() is two records from the same thread: Reallocate, with the
+// old block and the new size, then ReallocateResult, with the block returned.
+enum class RecordOp : uint8_t {
+    Allocate,
+    Deallocate,
+    Reallocate,
+    ReallocateResult
+};
+
+struct AllocRecord {
+    uint64_t timestamp;  // CLOCK_MONOTONIC, ns
+    uint64_t ptr;        // block address; links a free to its allocation
+    uint64_t size;       // requested size, 0 for frees
+    uint32_t ctx;        // tag passed to allocate(size, ctx)
+    uint16_t thread;     // small per-thread id, assigned on first record
+    RecordOp op;
+    uint8_t align_shift;  // log2 of the aligned_allocate alignment, else 0
+};
+
+static_assert(sizeof(AllocRecord) == 32);
+
+constexpr char RECORD_MAGIC[8] = {'M', 'K', 'V', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t RECORD_VERSION = 1;
+
+struct RecordFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+// Starts recording to path, truncating it. Returns false if a recording is
+// already running or the file cannot be created.
+bool record_start(const char* path);
+
+// Flushes every thread's buffer and closes the file. Calls racing with
+// record_stop may be left out of the file.
+void record_stop();
+
+// Allocator hooks
+extern std::atomic<bool> record_enabled;
+
+inline bool recording() {
+    return record_enabled.load(std::memory_order_relaxed);
+}
+
+void record_event(RecordOp op, size_t size, const void* ptr, uint32_t ctx, uint8_t align_shift = 0);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+// Bump-pointer allocation for objects that die together, such as everything
+// built while serving one request. A Region carves allocations back to back
+// out of chunks taken from the heap, with no per-object headers, and frees
+// them all at once with reset() or when it is destroyed; there is no
+// per-object free.
+//
+// Any number of threads may allocate from one region at once: the bump is a
+// single atomic add, and only taking a new chunk locks. reset() and the
+// destructor must not race with allocate().
+class Region {
+public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    explicit Region(size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    ~Region();
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    // n bytes aligned to `alignment`, a power of two; nullptr if the heap is
+    // out of memory or the alignment is not a power of two. Requests larger
+    // than a quarter of a chunk get a chunk of their own.
+    void* allocate(size_t n, size_t alignment = alignof(std::max_align_t));
+
+    // Frees everything allocated from the region. The current chunk is kept
+    // for the next round; the others go back to the heap.
+    void reset();
+
+    // Bytes taken from the heap for chunks
+    size_t chunk_bytes() const { return bytes.load(std::memory_order_relaxed); }
+
+private:
+    struct Chunk;
+    static const size_t CHUNK_HEADER;  // bytes before a chunk's bump space
+
+    std::atomic<Chunk*> current{nullptr};  // the chunk being bumped
+    Chunk* chunks = nullptr;               // all of them, newest first
+    std::atomic<size_t> bytes{0};
+    size_t chunk_size;
+    std::mutex refill_lock;                // guards chunks and replacing current
+
+    static void* bump(Chunk* chunk, size_t n, size_t alignment);
+    void* refill(size_t n, size_t alignment);
+    Chunk* take_chunk(size_t size);
+};
+
+// Lets standard containers allocate from a region, e.g.
+//   RegionResource resource(region);
+//   std::pmr::vector<int> v(&resource);
+// Deallocation does nothing; the memory comes back when the region is reset.
+class RegionResource final : public std::pmr::memory_resource {
+public:
+    explicit RegionResource(Region& region) : region(region) {}
+
+private:
+    Region& region;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
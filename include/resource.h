@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include "heap.h"
+
+// Lets standard containers allocate from the heap, e.g.
+//   MarkovMemoryResource nodes(true);
+//   std::pmr::map<int, int> m(&nodes);
+// By default allocations are predicted from the calling thread's model, like
+// allocate(size). A resource constructed with own_predictor = true keeps a
+// model of its own instead, so a container's allocations learn their pattern
+// without the rest of the thread's traffic mixed in; such a resource must
+// then be used by one thread at a time.
+//
+// Blocks are ordinary heap blocks: every MarkovMemoryResource compares equal
+// to every other, and memory from one may be freed through another or with
+// deallocate().
+class MarkovMemoryResource final : public std::pmr::memory_resource {
+public:
+    explicit MarkovMemoryResource(bool own_predictor = false);
+    ~MarkovMemoryResource();
+    MarkovMemoryResource(const MarkovMemoryResource&) = delete;
+    MarkovMemoryResource& operator=(const MarkovMemoryResource&) = delete;
+
+    // The resource's own model, for context_hit_rates; nullptr when it uses
+    // the thread's
+    const PredictionModel* model() const { return own; }
+
+private:
+    PredictionModel* own = nullptr;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// A standard allocator over the heap, for containers that are not pmr-aware:
+//   std::vector<int, MarkovAllocator<int>> v;
+// Without a resource it predicts from the calling thread's model; given one,
+// it allocates through it and so shares its model.
+template <typename T>
+class MarkovAllocator {
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    MarkovAllocator() noexcept = default;
+    explicit MarkovAllocator(MarkovMemoryResource* resource) noexcept : resource(resource) {}
+    template <typename U>
+    MarkovAllocator(const MarkovAllocator<U>& other) noexcept : resource(other.resource) {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+        size_t bytes = n == 0 ? 1 : n * sizeof(T);
+        if (resource != nullptr) return static_cast<T*>(resource->allocate(bytes, alignof(T)));
+        void* p = alignof(T) > alignof(std::max_align_t) ? aligned_allocate(bytes, alignof(T)) : ::allocate(bytes);
+        if (p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) noexcept { deallocate_sized(p, n == 0 ? 1 : n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const MarkovAllocator<U>&) const noexcept {
+        return true;
+    }
+
+private:
+    template <typename U>
+    friend class MarkovAllocator;
+
+    MarkovMemoryResource* resource = nullptr;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Structured event trace for the allocator's decisions. Recording is compiled
+// out unless the library is built with -DMARKOV_TRACE; when enabled, events go
+// to a fixed-size lock-free ring buffer that keeps the most recent
+// TRACE_CAPACITY records and never performs I/O.
+
+enum class TraceEvent : uint8_t {
+    CacheHit,    // a = request size
+    CacheMiss,   // a = request size
+    Predict,     // a = predicted size class, b = freed block size
+    PoolPush,    // a = pool class, b = block size
+    PoolRefill,  // a = blocks carved for the pools
+    Drain,       // a = blocks handed back to shards
+    Coalesce,    // a = merged block size
+    ArenaMap,    // a = arena size
+    ArenaRelease // a = arena size
+};
+
+struct TraceRecord {
+    uint64_t seq;       // position in the global event order
+    TraceEvent event;
+    uint32_t thread;    // small per-thread id, assigned on first event
+    uint64_t a;
+    uint64_t b;
+};
+
+constexpr size_t TRACE_CAPACITY = 4096;  // power of two
+
+#ifdef MARKOV_TRACE
+constexpr bool TRACE_ENABLED = true;
+#else
+constexpr bool TRACE_ENABLED = false;
+#endif
+
+template <bool Enabled>
+struct Tracer {
+    static void emit(TraceEvent, uint64_t = 0, uint64_t = 0) {}
+};
+
+template <>
+struct Tracer<true> {
+    static void emit(TraceEvent event, uint64_t a = 0, uint64_t b = 0);
+};
+
+using trace = Tracer<TRACE_ENABLED>;
+
+// Copies up to n of the most recent records into out, oldest first, and
+// returns how many were copied. Records being overwritten concurrently are
+// skipped.
+size_t trace_snapshot(TraceRecord* out, size_t n);
+
+const char* trace_event_name(TraceEvent event);
@@ -0,0 +1,103 @@
+#include "ContextPredictor.h"
+
+template <class ClassMap, int TableSize>
+BasicContextPredictor<ClassMap, TableSize>::BasicContextPredictor(uint16_t saturate_at)
+    : saturate_at(saturate_at < 2 ? 2 : saturate_at) {}
+
+template <class ClassMap, int TableSize>
+int BasicContextPredictor<ClassMap, TableSize>::slot_of(uint64_t context) {
+    // Fibonacci hashing: the top bits of the product are well mixed
+    constexpr int bits = __builtin_ctz(TableSize);
+    if constexpr (bits == 0) return 0;
+    return static_cast<int>((context * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+}
+
+template <class ClassMap, int TableSize>
+const typename BasicContextPredictor<ClassMap, TableSize>::Entry*
+BasicContextPredictor<ClassMap, TableSize>::find(uint64_t context) const {
+    const Entry& entry = table[slot_of(context)];
+    return context != 0 && entry.context == context ? &entry : nullptr;
+}
+
+template <class ClassMap, int TableSize>
+void BasicContextPredictor<ClassMap, TableSize>::update(uint64_t context, int to) {
+    if (context == 0 || to < 0 || to >= ClassMap::NUM_CLASSES) return;
+    Entry& entry = table[slot_of(context)];
+
+    // A colliding context has to wear the resident's counts down before it
+    // takes the slot, so one-off contexts do not evict established ones.
+    if (entry.context != context) {
+        bool empty = true;
+        for (int i = 0; i < WAYS; ++i) {
+            entry.count[i] >>= 1;
+            if (entry.count[i] != 0) empty = false;
+        }
+        if (!empty) return;
+        entry = Entry{};
+        entry.context = context;
+    }
+
+    int best = 0;
+    int found = -1;
+    int weakest = 0;
+    for (int i = 0; i < WAYS; ++i) {
+        if (entry.count[i] > entry.count[best]) best = i;
+        if (entry.count[i] != 0 && entry.state[i] == to) found = i;
+        if (entry.count[i] < entry.count[weakest]) weakest = i;
+    }
+
+    ++entry.stats.predictions;
+    if (entry.count[best] != 0 && entry.state[best] == to) ++entry.stats.hits;
+
+    // Space-saving: an unseen successor replaces the weakest one and inherits
+    // its count, so heavy hitters are never undercounted.
+    if (found < 0) {
+        found = weakest;
+        entry.state[found] = static_cast<uint8_t>(to);
+    }
+    if (entry.count[found] >= saturate_at) {
+        for (int i = 0; i < WAYS; ++i) entry.count[i] >>= 1;
+    }
+    ++entry.count[found];
+}
+
+template <class ClassMap, int TableSize>
+int BasicContextPredictor<ClassMap, TableSize>::predict(uint64_t context) const {
+    int state;
+    float prob;
+    return predict_top(context, 1, &state, &prob) > 0 ? state : -1;
+}
+
+template <class ClassMap, int TableSize>
+int BasicContextPredictor<ClassMap, TableSize>::predict_top(uint64_t context, int k, int* states, float* probs) const {
+    const Entry* entry = find(context);
+    if (entry == nullptr) return 0;
+
+    uint32_t total = 0;
+    for (int i = 0; i < WAYS; ++i) total += entry->count[i];
+    if (total == 0) return 0;
+
+    int n = 0;
+    for (int i = 0; i < WAYS; ++i) {
+        if (entry->count[i] == 0) continue;
+        float p = static_cast<float>(entry->count[i]) / total;
+
+        // Insertion into the sorted top-k prefix
+        int pos = n < k ? n++ : k;
+        while (pos > 0 && probs[pos - 1] < p) {
+            if (pos < k) {
+                states[pos] = states[pos - 1];
+                probs[pos] = probs[pos - 1];
+            }
+            --pos;
+        }
+        if (pos < k) {
+            states[pos] = entry->state[i];
+            probs[pos] = p;
+        }
+    }
+
+    return n;
+}
+
+template class BasicContextPredictor<DefaultSizeClasses>;
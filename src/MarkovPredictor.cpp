@@ -1,57 +1,188 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "MarkovPredictor.h"
 
-MarkovPredictor::MarkovPredictor() 
-    : count(Eigen::Matrix<float, MATRIX_SIZE, MATRIX_SIZE>::Zero()),
-      transition(Eigen::Matrix<float, MATRIX_SIZE, MATRIX_SIZE>::Zero()) {}
+// Snapshot files go through plain system calls: the predictor may live inside
+// malloc, where stdio would allocate.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t classes;
+};
 
-void MarkovPredictor::update_count(int old_state, int new_state) {
-    if (old_state >= 0 && old_state < MATRIX_SIZE && new_state >= 0 && new_state < MATRIX_SIZE) {
-        count(old_state, new_state)++;
+static_assert(sizeof(SnapshotHeader) == 16, "class sizes follow the header 8-byte aligned");
+
+constexpr char SNAPSHOT_MAGIC[8] = "MKVPRED";
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
     }
+    return true;
 }
 
-void MarkovPredictor::update_transition(int row) {
-    if (row < 0 || row >= MATRIX_SIZE) return;
-    
-    float sum = 0;
+template <class ClassMap>
+BasicMarkovPredictor<ClassMap>::BasicMarkovPredictor(uint32_t saturate_at)
+    : saturate_at(saturate_at < 2 ? 2 : saturate_at) {}
+
+template <class ClassMap>
+void BasicMarkovPredictor<ClassMap>::decay_row(int row) {
+    // Halving keeps every count's order, so best[row] stays an argmax
+    row_total[row] = 0;
     for (int i = 0; i < MATRIX_SIZE; ++i) {
-        sum += count(row, i);
+        count[row][i] >>= 1;
+        row_total[row] += count[row][i];
     }
-    
-    if (sum > 0) {
-        for (int i = 0; i < MATRIX_SIZE; ++i) {
-            transition(row, i) = count(row, i) / sum;
-        }
+}
+
+template <class ClassMap>
+void BasicMarkovPredictor<ClassMap>::update_count(int old_state, int new_state) {
+    if (old_state >= 0 && old_state < MATRIX_SIZE && new_state >= 0 && new_state < MATRIX_SIZE) {
+        PredictionStats& stats = row_stats[old_state];
+        ++stats.predictions;
+        if (row_total[old_state] != 0 && best[old_state] == new_state) ++stats.hits;
+
+        if (count[old_state][new_state] >= saturate_at) decay_row(old_state);
+
+        uint32_t c = ++count[old_state][new_state];
+        ++row_total[old_state];
+        if (c > count[old_state][best[old_state]]) best[old_state] = new_state;
     }
 }
 
-void MarkovPredictor::update(int from, int to) {
+template <class ClassMap>
+void BasicMarkovPredictor<ClassMap>::update(int from, int to) {
     update_count(from, to);
-    update_transition(from);
 }
 
-int MarkovPredictor::predict(int from) const {
+template <class ClassMap>
+int BasicMarkovPredictor<ClassMap>::predict(int from) const {
     if (from < 0 || from >= MATRIX_SIZE) return from;
-    
-    // Create current state vector
-    Eigen::Matrix<float, 1, MATRIX_SIZE> cur = 
-        Eigen::Matrix<float, 1, MATRIX_SIZE>::Zero();
-    cur(0, from) = 1;
-    
-    // Calculate next state probabilities
-    Eigen::Matrix<float, 1, MATRIX_SIZE> next = cur * transition;
-    
-    // Find state with maximum probability
-    int max_state = from;
-    float max_val = 0;
-    
+    if (row_total[from] == 0) return from;
+    return best[from];
+}
+
+template <class ClassMap>
+bool BasicMarkovPredictor<ClassMap>::trained(int from) const {
+    return from >= 0 && from < MATRIX_SIZE && row_total[from] != 0;
+}
+
+template <class ClassMap>
+int BasicMarkovPredictor<ClassMap>::predict_top(int from, int k, int* states, float* probs) const {
+    if (from < 0 || from >= MATRIX_SIZE || row_total[from] == 0) return 0;
+
+    int n = 0;
     for (int i = 0; i < MATRIX_SIZE; ++i) {
-        if (next(i) > max_val) {
-            max_val = next(i);
-            max_state = i;
+        if (count[from][i] == 0) continue;
+        float p = static_cast<float>(count[from][i]) / row_total[from];
+
+        // Insertion into the sorted top-k prefix
+        int pos = n < k ? n++ : k;
+        while (pos > 0 && probs[pos - 1] < p) {
+            if (pos < k) {
+                states[pos] = states[pos - 1];
+                probs[pos] = probs[pos - 1];
+            }
+            --pos;
+        }
+        if (pos < k) {
+            states[pos] = i;
+            probs[pos] = p;
         }
     }
-    
-    return max_state;
+
+    return n;
+}
+
+template <class ClassMap>
+PredictionStats BasicMarkovPredictor<ClassMap>::stats(int from) const {
+    if (from < 0 || from >= MATRIX_SIZE) return {};
+    return row_stats[from];
+}
+
+template <class ClassMap>
+bool BasicMarkovPredictor<ClassMap>::save(const char* path) const {
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.classes = MATRIX_SIZE;
+    uint64_t sizes[MATRIX_SIZE];
+    for (int c = 0; c < MATRIX_SIZE; ++c) sizes[c] = ClassMap::class_size(c);
+
+    // Written next to path and renamed over it, so a reader never maps half
+    // a snapshot
+    char temp[4096];
+    int len = std::snprintf(temp, sizeof temp, "%s.%d.tmp", path, static_cast<int>(getpid()));
+    if (len < 0 || static_cast<size_t>(len) >= sizeof temp) return false;
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, &header, sizeof header) && write_all(fd, sizes, sizeof sizes)
+              && write_all(fd, count, sizeof count);
+    ok &= close(fd) == 0;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) unlink(temp);
+    return ok;
+}
+
+template <class ClassMap>
+bool BasicMarkovPredictor<ClassMap>::check_snapshot(const void* data, size_t size) {
+    if (data == nullptr || size != SNAPSHOT_SIZE) return false;
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(data);
+    if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof header->magic) != 0) return false;
+    if (header->version != SNAPSHOT_VERSION || header->classes != MATRIX_SIZE) return false;
+    const uint64_t* sizes = reinterpret_cast<const uint64_t*>(header + 1);
+    for (int c = 0; c < MATRIX_SIZE; ++c) {
+        if (sizes[c] != ClassMap::class_size(c)) return false;
+    }
+    return true;
+}
+
+template <class ClassMap>
+bool BasicMarkovPredictor<ClassMap>::load(const void* data, size_t size) {
+    if (!check_snapshot(data, size)) return false;
+    const char* counts = static_cast<const char*>(data) + sizeof(SnapshotHeader) + MATRIX_SIZE * sizeof(uint64_t);
+    std::memcpy(count, counts, sizeof count);
+
+    for (int row = 0; row < MATRIX_SIZE; ++row) {
+        uint32_t* first = count[row];
+        uint32_t* top = first;
+        for (uint32_t* c = first; c != first + MATRIX_SIZE; ++c) {
+            if (*c > *top) top = c;
+        }
+        while (*top >= saturate_at) decay_row(row);
+        row_total[row] = 0;
+        for (int i = 0; i < MATRIX_SIZE; ++i) row_total[row] += count[row][i];
+        best[row] = static_cast<uint8_t>(top - first);
+        row_stats[row] = {};
+    }
+    return true;
+}
+
+template <class ClassMap>
+bool BasicMarkovPredictor<ClassMap>::load(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == SNAPSHOT_SIZE) {
+        mem = mmap(nullptr, SNAPSHOT_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) return false;
+    bool ok = load(mem, SNAPSHOT_SIZE);
+    munmap(mem, SNAPSHOT_SIZE);
+    return ok;
 }
 
+template class BasicMarkovPredictor<DefaultSizeClasses>;
+template class BasicMarkovPredictor<PowerOfTwoClasses>;
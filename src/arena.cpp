@@ -0,0 +1,912 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "heap.h"
+#include "heap_internal.h"
+#include "trace.h"
+
+constexpr size_t ARENA_OVERHEAD = ARENA_HEADER_SIZE + 2 * HEADER_SIZE;
+
+// Blocks looked at when the largest free block has to be found again
+constexpr int LARGEST_SCAN = 16;
+
+// Blocks looked at in a bin for the best fit
+constexpr int BEST_FIT_SCAN = 32;
+
+// Deferred coalescing: request threads merge MERGE_BATCH parked blocks every
+// MERGE_INTERVAL frees, and a shard never holds more than PARKED_LIMIT.
+constexpr size_t MERGE_INTERVAL = 64;
+constexpr size_t MERGE_BATCH = 32;
+constexpr size_t PARKED_LIMIT = 1024;
+
+Shard shards[NUM_SHARDS];
+
+std::atomic<bool> deferred_coalescing{false};
+std::atomic<PlacementPolicy> placement_policy{PlacementPolicy::SegregatedFit};
+std::atomic<bool> background_merging{false};
+
+// Lowest non-empty bin at or above `from`, or -1
+static int next_bin(const Shard& shard, int from) {
+	for (int word = from / 64; word < (NUM_BINS + 63) / 64; ++word) {
+		uint64_t bits = shard.bin_map[word];
+		if (word == from / 64) bits &= ~uint64_t(0) << from % 64;
+		if (bits != 0) return word * 64 + std::countr_zero(bits);
+	}
+	return -1;
+}
+
+// Highest non-empty bin, or -1
+static int last_bin(const Shard& shard) {
+	for (int word = (NUM_BINS + 63) / 64 - 1; word >= 0; --word) {
+		if (shard.bin_map[word] != 0) return word * 64 + 63 - std::countl_zero(shard.bin_map[word]);
+	}
+	return -1;
+}
+
+static char* block_of(FreeNode* node) {
+	return reinterpret_cast<char*>(node) - HEADER_SIZE;
+}
+
+// Biggest block among the first LARGEST_SCAN of the highest non-empty bin.
+// Blocks in one bin differ by less than its step, so this is close even when
+// the bin holds more blocks than are scanned.
+static size_t find_largest_free(Shard& shard) {
+	int bin = last_bin(shard);
+	if (bin < 0) return 0;
+	size_t largest = 0;
+	int seen = 0;
+	for (FreeNode* node = shard.free_lists[bin]; node != nullptr && seen < LARGEST_SCAN; node = node->next, ++seen) {
+		largest = std::max(largest, get_block_size(*(reinterpret_cast<size_t*>(block_of(node)))));
+	}
+	return largest;
+}
+
+static void insert_free(Shard& shard, char* block) {
+	size_t size = get_block_size(*(reinterpret_cast<size_t*>(block)));
+	FreeNode* node = reinterpret_cast<FreeNode*>(block + HEADER_SIZE);
+	int bin = free_bin(size);
+	FreeNode*& head = shard.free_lists[bin];
+	// Address-ordered placement keeps each bin sorted by address
+	FreeNode* prev = nullptr;
+	if (placement_policy.load(std::memory_order_relaxed) == PlacementPolicy::AddressOrdered) {
+		for (FreeNode* next = head; next != nullptr && next < node; next = next->next) prev = next;
+	}
+	FreeNode*& link = prev != nullptr ? prev->next : head;
+	node->prev = prev;
+	node->next = link;
+	if (link != nullptr) link->prev = node;
+	link = node;
+	shard.bin_map[bin / 64] |= uint64_t(1) << bin % 64;
+
+	add_relaxed(shard.free_bytes, size);
+	add_relaxed(shard.free_blocks, size_t(1));
+	if (size > shard.largest_free.load(std::memory_order_relaxed)) shard.largest_free.store(size, std::memory_order_relaxed);
+}
+
+static void remove_free(Shard& shard, char* block) {
+	size_t size = get_block_size(*(reinterpret_cast<size_t*>(block)));
+	FreeNode* node = reinterpret_cast<FreeNode*>(block + HEADER_SIZE);
+	if (node->prev != nullptr) {
+		node->prev->next = node->next;
+	} else {
+		int bin = free_bin(size);
+		shard.free_lists[bin] = node->next;
+		if (node->next == nullptr) shard.bin_map[bin / 64] &= ~(uint64_t(1) << bin % 64);
+	}
+	if (node->next != nullptr) node->next->prev = node->prev;
+
+	add_relaxed(shard.free_bytes, 0 - size);
+	add_relaxed(shard.free_blocks, size_t(0) - 1);
+	if (size == shard.largest_free.load(std::memory_order_relaxed)) {
+		shard.largest_free.store(find_largest_free(shard), std::memory_order_relaxed);
+	}
+}
+
+static char* first_block(Arena* arena) {
+	return reinterpret_cast<char*>(arena) + arena->first;
+}
+
+static size_t& header_of(char* block) {
+	return *reinterpret_cast<size_t*>(block);
+}
+
+// Writes a free block's header and footer and flags it in the next block's
+// header, which must already be in place.
+static void make_free(char* block, size_t size, bool prev_free) {
+	header_of(block) = size | (prev_free ? PREV_FREE : 0);
+	header_of(block + size - HEADER_SIZE) = size;
+	std::atomic_ref<size_t> next = shared_header(block + size);
+	next.store(next.load(std::memory_order_relaxed) | PREV_FREE, std::memory_order_relaxed);
+}
+
+// Writes an allocated block's header and clears the flag in the next block's.
+// A split writes the next header afterwards, over whatever this leaves there.
+static void make_allocated(char* block, size_t size, bool prev_free) {
+	header_of(block) = size | ALLOCATED | (prev_free ? PREV_FREE : 0);
+	std::atomic_ref<size_t> next = shared_header(block + size);
+	next.store(next.load(std::memory_order_relaxed) & ~PREV_FREE, std::memory_order_relaxed);
+}
+
+static uintptr_t align_up(uintptr_t value, size_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Neighbour lookups through the boundary tags. next_block returns nullptr at
+// the epilogue; prev_block only finds a free block, through its footer, and
+// returns nullptr when the one in front is allocated or there is none.
+static char* next_block(char* block) {
+	char* next = block + get_block_size(*(reinterpret_cast<size_t*>(block)));
+	return get_block_size(*(reinterpret_cast<size_t*>(next))) == 0 ? nullptr : next;
+}
+
+static char* prev_block(char* block) {
+	if (!is_prev_free(header_of(block))) return nullptr;
+	return block - get_block_size(header_of(block - HEADER_SIZE));
+}
+
+static bool is_first(char* block) {
+	return block == first_block(arena_of(block));
+}
+
+// Maps an arena whose first block has room for min_block_size bytes and an
+// `alignment` aligned payload. Alignments up to ARENA_SIZE are met by the
+// offset of the first block, since the base is ARENA_SIZE aligned; larger
+// ones put the base one arena below an aligned address and the first payload
+// right at it.
+static Arena* map_arena(Shard& shard, size_t min_block_size, size_t alignment = ALIGNMENT) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	// Offset of the first payload, past the header and its own block header
+	size_t lead = std::min<size_t>(align_up(ARENA_HEADER_SIZE + HEADER_SIZE, alignment), ARENA_SIZE);
+	size_t size = ARENA_SIZE;
+	if (min_block_size + lead > size) {
+		size = (min_block_size + lead + page - 1) / page * page;
+	}
+
+	// Over-map by one arena (or one alignment) and trim to the base
+	size_t span = std::max(alignment, ARENA_SIZE);
+	char* mem = reinterpret_cast<char*>(mmap(nullptr, size + span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (mem == MAP_FAILED) return nullptr;
+	uintptr_t start = reinterpret_cast<uintptr_t>(mem);
+	char* base = reinterpret_cast<char*>(alignment > ARENA_SIZE ? align_up(start + lead, alignment) - lead : align_up(start, ARENA_SIZE));
+	if (base != mem) munmap(mem, base - mem);
+	if (base + size != mem + size + span) munmap(base + size, mem + span - base);
+
+	Arena* arena = reinterpret_cast<Arena*>(base);
+	arena->size = size;
+	arena->next = nullptr;
+	arena->owner = &shard;
+	arena->first = lead - HEADER_SIZE;
+	for (std::atomic<uint64_t>& word : arena->slab_pages) word.store(0, std::memory_order_relaxed);
+
+	char* block = first_block(arena);
+	size_t block_size = size - lead;
+	header_of(block + block_size) = ALLOCATED;  // epilogue
+	make_free(block, block_size, false);
+	insert_free(shard, block);
+
+	// Append so the primary arena stays at the head of the list
+	Arena** link = &shard.arenas;
+	while (*link != nullptr) link = &(*link)->next;
+	*link = arena;
+	add_relaxed(shard.mapped_bytes, size);
+	trace::emit(TraceEvent::ArenaMap, size);
+	return arena;
+}
+
+static bool is_empty(Arena* arena) {
+	char* block = first_block(arena);
+	return !is_allocated(header_of(block)) && next_block(block) == nullptr;
+}
+
+// Whether a secondary arena other than `except` is fully free
+static bool has_spare_arena(Shard& shard, Arena* except) {
+	for (Arena* arena = shard.arenas->next; arena != nullptr; arena = arena->next) {
+		if (arena != except && arena->size == ARENA_SIZE && is_empty(arena)) return true;
+	}
+	return false;
+}
+
+// Gives the memory of a fully free arena back to the OS. Oversized arenas are
+// unmapped. One empty secondary arena per shard stays mapped, with its pages,
+// so a workload that keeps filling and emptying one does not map it again
+// every time; the others are unmapped. The primary arena keeps its mapping
+// but drops its pages.
+static void release_if_empty(Shard& shard, char* block) {
+	if (!is_first(block) || next_block(block) != nullptr) return;
+	if (is_allocated(*(reinterpret_cast<size_t*>(block)))) return;
+
+	Arena* arena = arena_of(block);
+	char* end = reinterpret_cast<char*>(arena) + arena->size;
+
+	if (arena != shard.arenas || arena->size != ARENA_SIZE) {
+		if (arena->size == ARENA_SIZE && !has_spare_arena(shard, arena)) return;
+		remove_free(shard, block);
+		Arena** link = &shard.arenas;
+		while (*link != arena) link = &(*link)->next;
+		*link = arena->next;
+		add_relaxed(shard.mapped_bytes, 0 - arena->size);
+		trace::emit(TraceEvent::ArenaRelease, arena->size);
+		munmap(arena, arena->size);
+		return;
+	}
+
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	// Keep the header and free-list links resident
+	uintptr_t lo = (reinterpret_cast<uintptr_t>(block) + HEADER_SIZE + sizeof(FreeNode) + page - 1) & ~(page - 1);
+	uintptr_t hi = (reinterpret_cast<uintptr_t>(end) - 2 * HEADER_SIZE) & ~(page - 1);
+	if (hi > lo) {
+		madvise(reinterpret_cast<void*>(lo), hi - lo, MADV_DONTNEED);
+	}
+}
+
+// Marks the first `total_size` bytes of a free block allocated, splitting off
+// the tail as a new free block when it is big enough to stand on its own.
+static char* place(Shard& shard, char* curr, size_t total_size) {
+	size_t block_size = get_block_size(header_of(curr));
+	bool prev_free = is_prev_free(header_of(curr));
+	size_t remainder = block_size - total_size;
+	remove_free(shard, curr);
+	if (remainder >= MIN_BLOCK_SIZE && arena_of(curr)->size == ARENA_SIZE) {
+		make_allocated(curr, total_size, prev_free);
+		make_free(curr + total_size, remainder, false);
+		insert_free(shard, curr + total_size);
+		return curr;
+	}
+	make_allocated(curr, block_size, prev_free);
+	return curr;
+}
+
+// Returns the first block in a bin that fits, or with `best` the smallest
+// fitting one among the first BEST_FIT_SCAN after it.
+static char* scan_bin(Shard& shard, int bin, size_t total_size, bool best) {
+	char* found = nullptr;
+	size_t found_size = SIZE_MAX;
+	int seen = 0;
+	for (FreeNode* node = shard.free_lists[bin]; node != nullptr; node = node->next) {
+		size_t size = get_block_size(*(reinterpret_cast<size_t*>(block_of(node))));
+		if (size >= total_size && size < found_size) {
+			found = block_of(node);
+			found_size = size;
+			if (!best || size == total_size) break;
+		}
+		if (best && found != nullptr && ++seen >= BEST_FIT_SCAN) break;
+	}
+	return found;
+}
+
+// Segregated fit: the head of the first non-empty bin at or above the
+// request's, found in the bin bitmap. Only when all of those are empty is the
+// bin just below scanned.
+static char* segregated_fit(Shard& shard, int c, size_t total_size) {
+	int bin = next_bin(shard, c);
+	if (bin >= 0) return block_of(shard.free_lists[bin]);
+	return c > 0 ? scan_bin(shard, c - 1, total_size, false) : nullptr;
+}
+
+// Best fit: blocks in the bin below the request's are smaller than any above
+// it, so the smallest that fits there wins; otherwise the smallest in the
+// first non-empty bin up.
+static char* best_fit(Shard& shard, int c, size_t total_size) {
+	char* found = c > 0 ? scan_bin(shard, c - 1, total_size, true) : nullptr;
+	if (found != nullptr) return found;
+	int bin = next_bin(shard, c);
+	return bin >= 0 ? scan_bin(shard, bin, total_size, true) : nullptr;
+}
+
+// Address-ordered first fit: the lowest block that fits. Bins are sorted by
+// address, so it is the lowest of the heads of the bins at or above the
+// request's and the first fit in the bin below.
+static char* address_fit(Shard& shard, int c, size_t total_size) {
+	char* found = c > 0 ? scan_bin(shard, c - 1, total_size, false) : nullptr;
+	for (int bin = next_bin(shard, c); bin >= 0; bin = next_bin(shard, bin + 1)) {
+		char* head = block_of(shard.free_lists[bin]);
+		if (found == nullptr || head < found) found = head;
+	}
+	return found;
+}
+
+static char* find_fit(Shard& shard, size_t total_size) {
+	int c = fit_bin(total_size);
+	switch (placement_policy.load(std::memory_order_relaxed)) {
+	case PlacementPolicy::BestFit:
+		return best_fit(shard, c, total_size);
+	case PlacementPolicy::AddressOrdered:
+		return address_fit(shard, c, total_size);
+	default:
+		return segregated_fit(shard, c, total_size);
+	}
+}
+
+// Like place(), but cuts the block so its payload is aligned. The slack in
+// front becomes a free block of its own, so it is either nothing or at least
+// MIN_BLOCK_SIZE; curr must have room for that and total_size more.
+static char* place_aligned(Shard& shard, char* curr, size_t total_size, size_t alignment) {
+	uintptr_t payload = reinterpret_cast<uintptr_t>(curr) + HEADER_SIZE;
+	size_t slack = align_up(payload, alignment) - payload;
+	if (slack != 0 && slack < MIN_BLOCK_SIZE) slack += alignment;
+	if (slack == 0) return place(shard, curr, total_size);
+
+	size_t block_size = get_block_size(header_of(curr));
+	remove_free(shard, curr);
+	char* aligned = curr + slack;
+	size_t rest = block_size - slack;
+	make_free(aligned, rest, false);
+	insert_free(shard, aligned);
+
+	make_free(curr, slack, is_prev_free(header_of(curr)));
+	insert_free(shard, curr);
+	return place(shard, aligned, total_size);
+}
+
+static void coalesce_block(Shard& shard, char* block) {
+    size_t block_size = get_block_size(*(reinterpret_cast<size_t*>(block)));
+    size_t original_size = block_size;
+
+    // Coalesce with next block
+    char* next_header = next_block(block);
+    if (next_header != nullptr) {
+        size_t next_size = get_block_size(*(reinterpret_cast<size_t*>(next_header)));
+        bool next_allocated = is_allocated(*(reinterpret_cast<size_t*>(next_header)));
+
+        if (!next_allocated) {
+            remove_free(shard, block);
+            remove_free(shard, next_header);
+            size_t new_size = block_size + next_size;
+            make_free(block, new_size, is_prev_free(header_of(block)));
+            insert_free(shard, block);
+            block_size = new_size;
+        }
+    }
+
+    // Coalesce with previous block
+    char* prev = prev_block(block);
+    if (prev != nullptr) {
+        size_t prev_size = get_block_size(*(reinterpret_cast<size_t*>(prev)));
+        bool prev_allocated = is_allocated(*(reinterpret_cast<size_t*>(prev)));
+
+        if (!prev_allocated) {
+            remove_free(shard, prev);
+            remove_free(shard, block);
+            size_t new_size = prev_size + block_size;
+            make_free(prev, new_size, is_prev_free(header_of(prev)));
+            insert_free(shard, prev);
+            block = prev;
+            block_size = new_size;
+        }
+    }
+
+    if (block_size != original_size) {
+        add_relaxed(shard.coalesces, uint64_t(1));
+        trace::emit(TraceEvent::Coalesce, block_size);
+    }
+
+    release_if_empty(shard, block);
+}
+
+static void coalesce_shard(Shard& shard) {
+    Arena* arena = shard.arenas;
+
+    while (arena != nullptr) {
+        Arena* next_arena = arena->next;
+        char* curr = first_block(arena);
+
+        while (curr != nullptr) {
+            size_t header = *(reinterpret_cast<size_t*>(curr));
+
+            if (!is_allocated(header)) {
+                // Absorb every free neighbour that follows
+                char* next = next_block(curr);
+                bool merged = false;
+                while (next != nullptr && !is_allocated(*(reinterpret_cast<size_t*>(next)))) {
+                    if (!merged) remove_free(shard, curr);
+                    merged = true;
+                    remove_free(shard, next);
+                    add_relaxed(shard.coalesces, uint64_t(1));
+                    size_t new_size = get_block_size(header) + get_block_size(*(reinterpret_cast<size_t*>(next)));
+                    make_free(curr, new_size, is_prev_free(header));
+                    header = *(reinterpret_cast<size_t*>(curr));
+                    next = next_block(curr);
+                }
+                if (merged) insert_free(shard, curr);
+
+                if (is_first(curr) && next == nullptr) {
+                    release_if_empty(shard, curr);
+                    break;
+                }
+            }
+
+            curr = next_block(curr);
+        }
+
+        arena = next_arena;
+    }
+}
+
+// Frees a block for real: onto the free lists, merged with its neighbours
+static void free_now(Shard& shard, char* block) {
+	size_t header = header_of(block);
+	make_free(block, get_block_size(header), is_prev_free(header));
+	insert_free(shard, block);
+	coalesce_block(shard, block);
+}
+
+static void park(Shard& shard, char* block, int c) {
+	*reinterpret_cast<char**>(block + HEADER_SIZE) = shard.parked[c];
+	shard.parked[c] = block;
+	++shard.parked_count;
+	add_relaxed(shard.parked_bytes, get_block_size(header_of(block)));
+}
+
+static char* unpark(Shard& shard, int c) {
+	char* block = shard.parked[c];
+	shard.parked[c] = *reinterpret_cast<char**>(block + HEADER_SIZE);
+	--shard.parked_count;
+	add_relaxed(shard.parked_bytes, 0 - get_block_size(header_of(block)));
+	return block;
+}
+
+// Frees up to `budget` parked blocks for real, taking the classes in turn
+static void merge_parked(Shard& shard, size_t budget) {
+	for (int tried = 0; tried < SizeClasses::NUM_CLASSES && budget > 0 && shard.parked_count > 0; ++tried) {
+		int c = shard.merge_cursor;
+		while (budget > 0 && shard.parked[c] != nullptr) {
+			free_now(shard, unpark(shard, c));
+			--budget;
+		}
+		if (shard.parked[c] == nullptr) shard.merge_cursor = (c + 1) % SizeClasses::NUM_CLASSES;
+	}
+	shard.frees_since_merge = 0;
+}
+
+// A parked block that serves total_size in full, or nullptr
+static char* take_parked(Shard& shard, size_t total_size) {
+	if (shard.parked_count == 0 || total_size > SizeClasses::MAX_SIZE) return nullptr;
+	int c = SizeClasses::class_of(total_size);
+	if (shard.parked[c] == nullptr) return nullptr;
+	return unpark(shard, c);
+}
+
+// Makes room after a failed search. Eager mode walks the whole shard; deferred
+// mode only frees its parked blocks, at most PARKED_LIMIT of them.
+static void reclaim(Shard& shard) {
+	if (deferred_coalescing.load(std::memory_order_relaxed)) {
+		merge_parked(shard, shard.parked_count);
+	} else {
+		coalesce_shard(shard);
+	}
+}
+
+char* shard_alloc(Shard& shard, size_t total_size, bool grow) {
+	char* curr = find_fit(shard, total_size);
+	if (curr != nullptr) return place(shard, curr, total_size);
+	char* parked = take_parked(shard, total_size);
+	if (parked != nullptr) return parked;
+	if (!grow) return nullptr;
+
+	// If no block found, try coalescing and retry
+	reclaim(shard);
+
+	curr = find_fit(shard, total_size);
+	if (curr != nullptr) return place(shard, curr, total_size);
+
+	// Still nothing: grow the shard by another arena
+	Arena* arena = map_arena(shard, total_size);
+	if (arena == nullptr) return nullptr;
+	return place(shard, first_block(arena), total_size);
+}
+
+// Cuts as many blocks of total_size as fit, up to n, from the front of a free
+// block in one pass. What is left becomes a free block of its own, or goes to
+// the last block if it is too small for that.
+static size_t carve(Shard& shard, char* curr, size_t total_size, size_t n, char** out) {
+	if (arena_of(curr)->size != ARENA_SIZE) {
+		out[0] = place(shard, curr, total_size);
+		return 1;
+	}
+
+	size_t block_size = get_block_size(header_of(curr));
+	bool prev_free = is_prev_free(header_of(curr));
+	size_t count = std::min(n, block_size / total_size);
+	size_t remainder = block_size - count * total_size;
+	remove_free(shard, curr);
+	for (size_t i = 0; i < count; ++i) {
+		size_t size = i == count - 1 && remainder < MIN_BLOCK_SIZE ? total_size + remainder : total_size;
+		make_allocated(curr, size, i == 0 && prev_free);
+		out[i] = curr;
+		curr += size;
+	}
+	if (remainder >= MIN_BLOCK_SIZE) {
+		make_free(curr, remainder, false);
+		insert_free(shard, curr);
+	}
+	return count;
+}
+
+size_t shard_alloc_batch(Shard& shard, size_t total_size, size_t n, char** out) {
+	size_t done = 0;
+	while (done < n) {
+		// Prefer a block that holds the whole rest of the batch
+		size_t rest = std::min(n - done, ARENA_SIZE / total_size + 1);
+		char* curr = find_fit(shard, rest * total_size);
+		if (curr == nullptr) curr = find_fit(shard, total_size);
+		if (curr == nullptr) {
+			reclaim(shard);
+			curr = find_fit(shard, total_size);
+		}
+		if (curr == nullptr) {
+			Arena* arena = map_arena(shard, total_size);
+			if (arena == nullptr) break;
+			curr = first_block(arena);
+		}
+		done += carve(shard, curr, total_size, n - done, out + done);
+	}
+	return done;
+}
+
+char* shard_alloc_aligned(Shard& shard, size_t total_size, size_t alignment) {
+	// Any block this big holds an aligned block after the slack in front
+	size_t padded = total_size + alignment + MIN_BLOCK_SIZE;
+	if (padded > ARENA_SIZE - ARENA_OVERHEAD) {
+		// Too big for a regular arena: map one whose single block is aligned
+		Arena* arena = map_arena(shard, total_size, alignment);
+		if (arena == nullptr) return nullptr;
+		return place(shard, first_block(arena), total_size);
+	}
+
+	char* curr = find_fit(shard, padded);
+	if (curr == nullptr || arena_of(curr)->size != ARENA_SIZE) {
+		reclaim(shard);
+		curr = find_fit(shard, padded);
+	}
+	if (curr == nullptr || arena_of(curr)->size != ARENA_SIZE) {
+		Arena* arena = map_arena(shard, 0);
+		if (arena == nullptr) return nullptr;
+		curr = first_block(arena);
+	}
+	return place_aligned(shard, curr, total_size, alignment);
+}
+
+// Whether shard_free parks the block rather than freeing it now
+static bool parks(char* block) {
+	return deferred_coalescing.load(std::memory_order_relaxed) && get_block_size(header_of(block)) <= SizeClasses::MAX_SIZE
+	       && arena_of(block)->size == ARENA_SIZE;
+}
+
+void shard_free(Shard& shard, char* block) {
+	size_t size = get_block_size(header_of(block));
+	if (!parks(block)) {
+		free_now(shard, block);
+		return;
+	}
+
+	park(shard, block, SizeClasses::floor_class(size));
+	// With a background thread merging, request threads only step in when a
+	// shard's parked blocks reach the limit
+	bool due = background_merging.load(std::memory_order_relaxed) ? shard.parked_count >= PARKED_LIMIT
+	                                                               : ++shard.frees_since_merge >= MERGE_INTERVAL
+	                                                                     || shard.parked_count >= PARKED_LIMIT;
+	if (due) merge_parked(shard, MERGE_BATCH);
+}
+
+void shard_free_batch(Shard& shard, char** blocks, int n) {
+	// Parked blocks go their own way; the rest are marked free, still off the
+	// free lists
+	int count = 0;
+	for (int i = 0; i < n; ++i) {
+		if (parks(blocks[i])) {
+			shard_free(shard, blocks[i]);
+			continue;
+		}
+		size_t header = header_of(blocks[i]);
+		make_free(blocks[i], get_block_size(header), is_prev_free(header));
+		blocks[count++] = blocks[i];
+	}
+
+	// In address order, each block absorbs the free run that follows it, the
+	// batch's own blocks included, and joins a free block before it. Blocks
+	// it absorbed are skipped, so every run is merged and listed once.
+	std::sort(blocks, blocks + count);
+	for (int i = 0; i < count;) {
+		char* start = blocks[i++];
+		char* end = start + get_block_size(header_of(start));
+		int merges = 0;
+		while (!is_allocated(header_of(end))) {
+			if (i < count && end == blocks[i]) {
+				++i;
+			} else {
+				remove_free(shard, end);
+			}
+			end += get_block_size(header_of(end));
+			++merges;
+		}
+		if (char* prev = prev_block(start)) {
+			remove_free(shard, prev);
+			start = prev;
+			++merges;
+		}
+		make_free(start, static_cast<size_t>(end - start), is_prev_free(header_of(start)));
+		insert_free(shard, start);
+		if (merges > 0) {
+			add_relaxed(shard.coalesces, uint64_t(merges));
+			trace::emit(TraceEvent::Coalesce, static_cast<size_t>(end - start));
+		}
+		release_if_empty(shard, start);
+	}
+}
+
+// A grow absorbs the free block that follows, and whatever is left over past
+// total_size is split off and freed, as in place().
+bool shard_resize(Shard& shard, char* block, size_t total_size) {
+	size_t block_size = get_block_size(header_of(block));
+	bool prev_free = is_prev_free(header_of(block));
+	if (total_size > block_size) {
+		char* next = next_block(block);
+		if (next == nullptr || is_allocated(*(reinterpret_cast<size_t*>(next)))) return false;
+		size_t next_size = get_block_size(*(reinterpret_cast<size_t*>(next)));
+		if (block_size + next_size < total_size) return false;
+
+		remove_free(shard, next);
+		block_size += next_size;
+		make_allocated(block, block_size, prev_free);
+	}
+
+	size_t remainder = block_size - total_size;
+	if (remainder >= MIN_BLOCK_SIZE && arena_of(block)->size == ARENA_SIZE) {
+		make_allocated(block, total_size, prev_free);
+		make_allocated(block + total_size, remainder, false);
+		free_now(shard, block + total_size);
+	}
+	return true;
+}
+
+// Slab page bit of the slab starting at `slab`
+static void mark_slab_page(Slab* slab, bool set) {
+	Arena* arena = arena_of(slab);
+	size_t page = static_cast<size_t>(reinterpret_cast<char*>(slab) - reinterpret_cast<char*>(arena)) / SLAB_SIZE;
+	uint64_t bit = uint64_t(1) << (page % 64);
+	if (set) {
+		arena->slab_pages[page / 64].fetch_or(bit, std::memory_order_relaxed);
+	} else {
+		arena->slab_pages[page / 64].fetch_and(~bit, std::memory_order_relaxed);
+	}
+}
+
+static void link_slab(Shard& shard, Slab* slab) {
+	Slab*& head = shard.slabs[slab->cls];
+	slab->prev = nullptr;
+	slab->next = head;
+	if (head != nullptr) head->prev = slab;
+	head = slab;
+}
+
+static void unlink_slab(Shard& shard, Slab* slab) {
+	if (slab->prev != nullptr) {
+		slab->prev->next = slab->next;
+	} else {
+		shard.slabs[slab->cls] = slab->next;
+	}
+	if (slab->next != nullptr) slab->next->prev = slab->prev;
+}
+
+// A SLAB_SIZE block whose payload is page aligned holds the whole slab, so
+// slabs cut one after another from a free block sit back to back.
+static Slab* new_slab(Shard& shard, int c, bool grow) {
+	char* block = nullptr;
+	if (grow) {
+		block = shard_alloc_aligned(shard, SLAB_SIZE, SLAB_SIZE);
+	} else {
+		char* curr = find_fit(shard, 2 * SLAB_SIZE + MIN_BLOCK_SIZE);
+		if (curr != nullptr && arena_of(curr)->size == ARENA_SIZE) block = place_aligned(shard, curr, SLAB_SIZE, SLAB_SIZE);
+	}
+	if (block == nullptr) return nullptr;
+
+	Slab* slab = reinterpret_cast<Slab*>(block + HEADER_SIZE);
+	size_t slot_size = SizeClasses::class_size(c);
+	size_t slots = (SLAB_SIZE - HEADER_SIZE - align(sizeof(Slab))) / slot_size;
+	slab->slot_size = static_cast<uint32_t>(slot_size);
+	slab->slots = static_cast<uint16_t>(slots);
+	slab->free_count = static_cast<uint16_t>(slots);
+	slab->cls = c;
+	for (size_t w = 0; w < 4; ++w) {
+		size_t bits = std::min<size_t>(64, slots > 64 * w ? slots - 64 * w : 0);
+		slab->free_slots[w] = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+	}
+	link_slab(shard, slab);
+	mark_slab_page(slab, true);
+	return slab;
+}
+
+size_t slab_alloc(Shard& shard, int c, size_t n, char** out, bool grow) {
+	size_t done = 0;
+	while (done < n) {
+		Slab* slab = shard.slabs[c];
+		if (slab == nullptr) slab = new_slab(shard, c, grow);
+		if (slab == nullptr) break;
+
+		char* slots = reinterpret_cast<char*>(slab) + align(sizeof(Slab));
+		for (int w = 0; w < 4 && done < n; ++w) {
+			uint64_t& word = slab->free_slots[w];
+			while (word != 0 && done < n) {
+				int i = 64 * w + std::countr_zero(word);
+				word &= word - 1;
+				out[done++] = slots + i * slab->slot_size - HEADER_SIZE;
+				--slab->free_count;
+			}
+		}
+		if (slab->free_count == 0) unlink_slab(shard, slab);
+	}
+	return done;
+}
+
+void slab_free(Shard& shard, char* block) {
+	char* ptr = block + HEADER_SIZE;
+	Slab* slab = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(SLAB_SIZE - 1));
+	size_t i = static_cast<size_t>(ptr - (reinterpret_cast<char*>(slab) + align(sizeof(Slab)))) / slab->slot_size;
+	slab->free_slots[i / 64] |= uint64_t(1) << (i % 64);
+	if (slab->free_count++ == 0) link_slab(shard, slab);
+
+	// Keep one empty slab per class so a class that empties and refills does
+	// not cut a new slab every time
+	if (slab->free_count == slab->slots && (shard.slabs[slab->cls] != slab || slab->next != nullptr)) {
+		unlink_slab(shard, slab);
+		mark_slab_page(slab, false);
+		free_now(shard, reinterpret_cast<char*>(slab) - HEADER_SIZE);
+	}
+}
+
+bool initHeap(){
+	bool mapped = true;
+	for (Shard& shard : shards) {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		if (shard.arenas == nullptr && map_arena(shard, 0) == nullptr) mapped = false;
+	}
+	return mapped;
+}
+
+void coalesce_one(char* block) {
+	if (!block || arena_of(block)->owner == nullptr) return;
+
+	Shard& shard = *arena_of(block)->owner;
+	std::lock_guard<std::mutex> guard(shard.lock);
+	if (!is_allocated(*(reinterpret_cast<size_t*>(block)))) coalesce_block(shard, block);
+}
+
+void coalesce_clean() {
+	drain_pending();
+	for (Shard& shard : shards) {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		merge_parked(shard, shard.parked_count);
+		coalesce_shard(shard);
+	}
+}
+
+// Bottom-up merge sort of a bin by address, relinking the prev pointers after
+static void sort_bin(FreeNode*& head) {
+	for (size_t run = 1;; run *= 2) {
+		FreeNode* rest = head;
+		FreeNode** tail = &head;
+		int merges = 0;
+		while (rest != nullptr) {
+			++merges;
+			FreeNode* a = rest;
+			FreeNode* b = a;
+			size_t a_left = 0, b_left = run;
+			while (a_left < run && b != nullptr) {
+				b = b->next;
+				++a_left;
+			}
+			while (a_left > 0 || (b_left > 0 && b != nullptr)) {
+				bool take_a = a_left > 0 && (b_left == 0 || b == nullptr || a < b);
+				FreeNode*& from = take_a ? a : b;
+				*tail = from;
+				tail = &from->next;
+				from = from->next;
+				--(take_a ? a_left : b_left);
+			}
+			rest = b;
+		}
+		*tail = nullptr;
+		if (merges <= 1) break;
+	}
+	FreeNode* prev = nullptr;
+	for (FreeNode* node = head; node != nullptr; node = node->next) {
+		node->prev = prev;
+		prev = node;
+	}
+}
+
+void set_placement_policy(PlacementPolicy policy) {
+	placement_policy.store(policy, std::memory_order_relaxed);
+	if (policy != PlacementPolicy::AddressOrdered) return;
+	for (Shard& shard : shards) {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		for (FreeNode*& head : shard.free_lists) sort_bin(head);
+	}
+}
+
+void set_deferred_coalescing(bool deferred) {
+	if (deferred_coalescing.exchange(deferred) && !deferred) {
+		for (Shard& shard : shards) {
+			std::lock_guard<std::mutex> guard(shard.lock);
+			merge_parked(shard, shard.parked_count);
+		}
+	}
+}
+
+// The background merger. It takes each shard's lock only with try_lock, so it
+// never queues behind a request thread, and merges one batch per visit. It may
+// outlive main(), so nothing it touches has a destructor.
+static std::mutex merger_lock;
+static std::thread* merger = nullptr;
+static std::atomic<bool> merger_stop{false};
+
+static void merge_loop(std::chrono::milliseconds interval) {
+	while (!merger_stop.load(std::memory_order_relaxed)) {
+		for (Shard& shard : shards) {
+			if (!shard.lock.try_lock()) continue;
+			if (shard.parked_count > 0) merge_parked(shard, MERGE_BATCH);
+			shard.lock.unlock();
+		}
+		std::this_thread::sleep_for(interval);
+	}
+}
+
+bool start_background_coalescing(unsigned interval_ms) {
+	std::lock_guard<std::mutex> guard(merger_lock);
+	if (merger != nullptr) return false;
+	merger_stop.store(false, std::memory_order_relaxed);
+	try {
+		merger = new std::thread(merge_loop, std::chrono::milliseconds(std::max(interval_ms, 1u)));
+	} catch (...) {
+		return false;
+	}
+	background_merging.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void stop_background_coalescing() {
+	std::lock_guard<std::mutex> guard(merger_lock);
+	if (merger == nullptr) return;
+	merger_stop.store(true, std::memory_order_relaxed);
+	merger->join();
+	delete merger;
+	merger = nullptr;
+	background_merging.store(false, std::memory_order_relaxed);
+}
+
+void print_heap() {
+	drain_pending();
+	std::cout << "Heap state:\n";
+
+	for (int s = 0; s < NUM_SHARDS; ++s) {
+		std::lock_guard<std::mutex> guard(shards[s].lock);
+		int index = 0;
+
+		for (Arena* arena = shards[s].arenas; arena != nullptr; arena = arena->next, ++index) {
+			char* base = first_block(arena);
+			bool empty = get_block_size(*(reinterpret_cast<size_t*>(base))) == arena->size - arena->first - HEADER_SIZE
+			          && !is_allocated(*(reinterpret_cast<size_t*>(base)));
+			if (empty) continue;  // untouched shards would only add noise
+			std::cout << "Shard " << s << " arena " << index << " | Size: " << arena->size << "\n";
+
+			for (char* curr = base; curr != nullptr; curr = next_block(curr)) {
+				size_t header = *((size_t*) curr);
+				size_t block_size = get_block_size(header);
+				bool allocated = is_allocated(header);
+
+				std::cout << "Block at offset " << (curr - base)
+				          << " | Size: " << block_size
+				          << " | Allocated: " << (allocated ? "Yes" : "No") << "\n";
+
+				if (block_size % ALIGNMENT != 0) {
+					std::cerr << "Error: Invalid block size at offset " << (curr - base) << "\n";
+					break;
+				}
+			}
+		}
+	}
+	std::cout << std::endl;
+}
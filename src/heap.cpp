@@ -1,311 +1,1032 @@
-#include <iostream>
-#include <sys/mman.h>
-#include <bit>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include "heap.h"
-#include "MarkovPredictor.h"
-
-constexpr size_t HEAP_SIZE = 4096;
-constexpr size_t ALIGNMENT = 8;
-constexpr size_t HEADER_SIZE = sizeof(size_t);
-
-size_t heapSize = 0;
-char* heapStart = nullptr;
-
-int prev_guess = -1;
-int cache_guess = -1;
-void* cache_ptr = nullptr;
-
-// Forward declarations
-bool is_allocated(size_t header);
-size_t get_block_size(size_t header);
-void set_header(char* block, size_t size, bool allocated);
-
-static bool validate_and_set_cache(void* ptr, int guess) {
-    if (ptr == nullptr) return false;
-    
-    char* block = reinterpret_cast<char*>(ptr) - HEADER_SIZE;
-    size_t block_size = get_block_size(*(reinterpret_cast<size_t*>(block)));
-    bool allocated = is_allocated(*(reinterpret_cast<size_t*>(block)));
-    
-    if (allocated) return false;
-    
-    size_t user_size = block_size - 2 * HEADER_SIZE;
-    int size_class = log2(std::bit_ceil(static_cast<unsigned int>(user_size)));
-    
-    if (size_class == guess) {
-        cache_ptr = ptr;
-        return true;
-    } else if (size_class >= guess + 1) {
-        // Split block for cache if it's larger than needed
-        size_t target_size = (1 << guess) + 2 * HEADER_SIZE;
-        if (block_size >= target_size + 2 * HEADER_SIZE + ALIGNMENT) {
-            // Split the block
-            set_header(block, target_size, false);
-            set_header(block + target_size - HEADER_SIZE, target_size, false);
-            
-            size_t remainder = block_size - target_size;
-            set_header(block + target_size, remainder, false);
-            set_header(block + target_size + remainder - HEADER_SIZE, remainder, false);
-            
-            cache_ptr = block + HEADER_SIZE;
-            return true;
-        }
-    }
-    
-    return false;
-}
-
-MarkovPredictor predictor;
-
-bool is_allocated(size_t header) {
-	return header & 1;
-}
-
-size_t get_block_size(size_t header) {
-	return header & ~1;
-}
-
-void set_header(char* block, size_t size, bool allocated) {
-	*(reinterpret_cast<size_t*> (block)) = size | (allocated ? 1: 0);
-}
-
-size_t align(size_t size) {
-	return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-}
-
-void initHeap(){
-	if (heapStart != nullptr) return;
-
-	heapStart = reinterpret_cast<char*>(mmap(nullptr, HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
-	if (heapStart == MAP_FAILED){
-		std::cerr << "mmap failed to initialize heap";
+#include "heap_internal.h"
+#include "PredictionModel.h"
+#include "recorder.h"
+#include "trace.h"
+
+// Predictive cache: a small pool of ready blocks per size class. Pooled blocks
+// stay marked allocated, so coalescing and the free lists never see them. How
+// deep each pool may get follows the predicted probability of its class, and
+// the total bytes held across pools are capped by cache_budget.
+constexpr int POOL_CLASSES = MarkovPredictor::MATRIX_SIZE;
+constexpr int POOL_DEPTH = 8;
+constexpr int POOL_TOP_K = 3;
+
+// Lookahead on a pool miss: the classes expected within the next
+// LOOKAHEAD_STEPS allocations, followed along a beam of the LOOKAHEAD_BEAM
+// likeliest ones at each step, are pre-carved and kept, as many blocks as
+// they are expected to be allocated up to LOOKAHEAD_DEPTH. The walk only
+// starts from a class whose most likely successor comes true at least
+// LOOKAHEAD_MIN_HIT_RATE of the time, and drops paths less likely than
+// LOOKAHEAD_MIN_PROB.
+constexpr int LOOKAHEAD_STEPS = 6;
+constexpr int LOOKAHEAD_BEAM = 4;
+constexpr int LOOKAHEAD_DEPTH = 4;
+constexpr float LOOKAHEAD_MIN_HIT_RATE = 0.4f;
+constexpr float LOOKAHEAD_MIN_PROB = 0.1f;
+
+// Every ADAPT_WINDOW allocations a thread checks that its pools pay for
+// themselves: below ADAPT_MIN_HIT_RATE pool hits it stops pooling, and it
+// starts again once its predictor, which keeps learning, names that share of
+// the allocations correctly.
+constexpr int ADAPT_WINDOW = 4096;
+constexpr float ADAPT_MIN_HIT_RATE = 0.25f;
+
+// While a thread is not pooling, its predictor learns from one allocation in
+// IDLE_SAMPLE and only follows the others, and each class keeps up to
+// REUSE_DEPTH of the thread's own frees for its next allocations.
+constexpr int IDLE_SAMPLE = 16;
+constexpr int REUSE_DEPTH = 32;
+
+// Freed blocks that are not pooled are handed back to their shards this many
+// at a time.
+constexpr int DRAIN_BATCH = 32;
+
+// Blocks at least this large skip the drain buffer and go back at once
+constexpr size_t DIRECT_FREE_SIZE = ARENA_SIZE / 8;
+
+// allocate_batch and deallocate_batch work through their blocks this many at
+// a time.
+constexpr int BATCH_CHUNK = 64;
+
+struct Pool {
+	char* blocks[POOL_DEPTH];
+	int count;
+};
+
+struct ReuseList {
+	char* blocks[REUSE_DEPTH];
+	int count;
+};
+
+// Per-thread front end. Allocation and deallocation only touch this state
+// until a pool misses or the drain buffer fills up; then the thread takes a
+// shard lock once for the whole batch.
+struct ThreadCache {
+	PredictionModel model;
+	Pool pools[POOL_CLASSES] = {};
+	int targets[POOL_CLASSES];  // pool depths for the current prediction
+	int lookahead[POOL_CLASSES] = {};  // depths for classes further ahead, as of the last miss
+	bool lookahead_set = false;  // lookahead has nonzero entries
+	bool targets_stale = true;  // set once the prediction moves on
+	bool caching = true;  // off while the pools do not pay for themselves
+	int window_allocations = 0;
+	int window_predicted = 0;  // informed predictions that came true this window
+	uint64_t window_start_hits = 0;  // stats->hits at the start of the window
+	size_t cached_bytes = 0;
+	Shard* home;
+	ThreadStats* stats;
+	ReuseList reuse[POOL_CLASSES] = {};  // own frees kept while not caching
+	size_t reuse_bytes = 0;
+	char* pending[DRAIN_BATCH];
+	int pending_count = 0;
+
+	ThreadCache();
+	~ThreadCache();
+};
+
+std::atomic<size_t> cache_budget{64 * 1024};  // per thread
+std::atomic<unsigned> next_home{0};
+std::atomic<int> predictor_order{1};
+std::atomic<float> prediction_threshold{DEFAULT_PREDICTION_THRESHOLD};
+std::atomic<bool> adaptive_caching{true};
+
+// Snapshot that new threads' predictors start from, mapped by
+// load_prediction_profile. It stays mapped, since a thread may be copying it.
+std::atomic<const void*> profile{nullptr};
+
+// Pool targets while a thread is not caching
+constexpr int NO_TARGETS[POOL_CLASSES] = {};
+
+// The cache lives in plain TLS storage and is built on the thread's first
+// call, because the allocator may be malloc itself: a thread_local object with
+// a constructor would register its destructor through __cxa_thread_atexit,
+// which allocates. It is torn down by a pthread key destructor instead.
+enum class CacheState : uint8_t { Fresh, Building, Ready, Gone };
+
+alignas(ThreadCache) thread_local unsigned char cache_storage[sizeof(ThreadCache)];
+thread_local CacheState cache_state = CacheState::Fresh;
+
+pthread_key_t cache_key;
+pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static_assert(SizeClasses::class_size(SLAB_CLASSES) >= MIN_BLOCK_SIZE, "the smallest block class must hold a free block");
+static_assert(SizeClasses::MAX_SIZE <= ARENA_SIZE / 2, "pooled blocks must fit in a regular arena");
+
+// Block size handed out for a request served by a heap block rather than a
+// slab slot. Requests within the block classes are rounded up to their class
+// size so that any block in a pool can serve any request of its class.
+static size_t block_size_for(size_t request_size) {
+	int c = size_class(request_size);
+	if (c >= SLAB_CLASSES && c < POOL_CLASSES) return SizeClasses::class_size(c);
+	return std::max(align(request_size + HEADER_SIZE), MIN_BLOCK_SIZE);
+}
+
+// Bytes behind an allocation of class c: a slab class's slot, or the block,
+// which may be a little larger than its class.
+static size_t class_bytes(int c, char* block) {
+	return c < SLAB_CLASSES ? SizeClasses::class_size(c) : block_size_of(block);
+}
+
+// Same, for an allocation whose class is not known
+static size_t block_bytes(char* block) {
+	Slab* slab = slab_of(block);
+	return slab != nullptr ? slab->slot_size : block_size_of(block);
+}
+
+// Sets the pool depth each class should have for the next allocation: the
+// top-k predicted successors at or above prediction_threshold get a share of
+// POOL_DEPTH proportional to their probability, and classes expected a few
+// allocations later keep what the last lookahead gave them.
+static void compute_targets(ThreadCache& tc, const PredictionModel& model) {
+	int* targets = tc.targets;
+	std::copy(tc.lookahead, tc.lookahead + POOL_CLASSES, targets);
+	tc.targets_stale = false;
+
+	int states[POOL_TOP_K];
+	float probs[POOL_TOP_K];
+	int n = model.predict_top(POOL_TOP_K, states, probs);
+	float threshold = prediction_threshold.load(std::memory_order_relaxed);
+	for (int i = 0; i < n && probs[i] >= threshold; ++i) {
+		int& target = targets[states[i]];
+		target = std::min(POOL_DEPTH, target + static_cast<int>(std::ceil(probs[i] * POOL_DEPTH)));
+	}
+}
+
+// Walks the first-order matrix LOOKAHEAD_STEPS allocations past the next one,
+// keeping the LOOKAHEAD_BEAM likeliest classes at each step, and adds up how
+// often each class is expected along the way, counting a step only where the
+// class is at least as likely as prediction_threshold. Run on pool misses
+// only, so its cost is paid on the slow path; the pools then hold blocks for
+// the classes a repeating pattern comes back to, rather than only for the one
+// expected next.
+static void compute_lookahead(ThreadCache& tc, const PredictionModel& model) {
+	PredictionStats row = model.predictor.stats(model.prev_class);
+	if (row.hits < LOOKAHEAD_MIN_HIT_RATE * row.predictions) {
+		if (tc.lookahead_set) {
+			std::fill(tc.lookahead, tc.lookahead + POOL_CLASSES, 0);
+			tc.lookahead_set = false;
+			tc.targets_stale = true;
+		}
 		return;
 	}
-	heapSize = HEAP_SIZE;
-	std::cout << "heap successfully initialized\n";
 
-	*(reinterpret_cast<size_t*>(heapStart)) = HEAP_SIZE | 0;
-	*(reinterpret_cast<size_t*>(heapStart + heapSize - HEADER_SIZE)) = HEAP_SIZE | 0;
+	float threshold = prediction_threshold.load(std::memory_order_relaxed);
+	float expected[POOL_CLASSES] = {};
+	int beam[LOOKAHEAD_BEAM];
+	float beam_probs[LOOKAHEAD_BEAM];
+	int n = model.predictor.predict_top(model.prev_class, LOOKAHEAD_BEAM, beam, beam_probs);
+	while (n > 0 && beam_probs[n - 1] < LOOKAHEAD_MIN_PROB) --n;
+
+	for (int step = 0; step < LOOKAHEAD_STEPS && n > 0; ++step) {
+		int next[LOOKAHEAD_BEAM];
+		float next_probs[LOOKAHEAD_BEAM];
+		int m = 0;
+		for (int i = 0; i < n; ++i) {
+			int states[LOOKAHEAD_BEAM];
+			float probs[LOOKAHEAD_BEAM];
+			int k = model.predictor.predict_top(beam[i], LOOKAHEAD_BEAM, states, probs);
+			for (int j = 0; j < k; ++j) {
+				float p = beam_probs[i] * probs[j];
+				if (p < LOOKAHEAD_MIN_PROB) break;
+				// Paths meeting at a class add up; otherwise the likeliest are kept
+				int at = std::find(next, next + m, states[j]) - next;
+				if (at < m) {
+					next_probs[at] += p;
+				} else if (m < LOOKAHEAD_BEAM) {
+					next[m] = states[j];
+					next_probs[m++] = p;
+				} else {
+					int weakest = std::min_element(next_probs, next_probs + m) - next_probs;
+					if (next_probs[weakest] < p) {
+						next[weakest] = states[j];
+						next_probs[weakest] = p;
+					}
+				}
+			}
+		}
+		for (int i = 0; i < m; ++i) {
+			if (next_probs[i] >= threshold) expected[next[i]] += next_probs[i];
+		}
+		std::copy(next, next + m, beam);
+		std::copy(next_probs, next_probs + m, beam_probs);
+		n = m;
+	}
+
+	for (int c = 0; c < POOL_CLASSES; ++c) {
+		tc.lookahead[c] = std::min(LOOKAHEAD_DEPTH, static_cast<int>(std::ceil(expected[c])));
+	}
+	tc.lookahead_set = true;
+	tc.targets_stale = true;
 }
 
-void* allocate(size_t request_size) {
-	if (request_size == 0) return nullptr;
-	if (request_size > HEAP_SIZE - 2 * HEADER_SIZE) return nullptr;
-	
-	size_t total_size = align(request_size) + 2 * HEADER_SIZE;
-	char* curr = heapStart;
-
-	// Check cache first
-	if (std::bit_ceil(static_cast<unsigned int>(request_size)) == static_cast<unsigned int>(cache_guess) && cache_ptr != nullptr) {
-		std::cout << "CACHE HIT! Reusing cached block for size " << request_size << std::endl;
-		curr = reinterpret_cast<char*>(cache_ptr) - HEADER_SIZE;
-		size_t block_size = get_block_size(*(reinterpret_cast<size_t*>(curr)));
-		set_header(curr, block_size, true);
-		set_header(curr + block_size - HEADER_SIZE, block_size, true);
-		cache_ptr = nullptr; // Clear cache after use
-		cache_guess = -1;
-		return curr + HEADER_SIZE;
-	}
-
-	// Coalesce any cached block that wasn't used
-	if (cache_ptr != nullptr) {
-		coalesce_one(reinterpret_cast<char*>(cache_ptr) - HEADER_SIZE);
-	}
-	cache_guess = 0;
-	cache_ptr = nullptr;
-
-	// Update Markov predictor
-	if (prev_guess != -1) {
-		predictor.update(log2(prev_guess), log2(std::bit_ceil(static_cast<unsigned int>(request_size))));
-	}
-
-	prev_guess = std::bit_ceil(static_cast<unsigned int>(request_size));
-
-	// First-fit allocation
-	while (curr < heapStart + HEAP_SIZE){
-		size_t header = *(reinterpret_cast<size_t*> (curr));
-		size_t block_size = get_block_size(header);
-		bool allocated = is_allocated(header);
-
-		if (!allocated && block_size >= total_size) {
-			size_t remainder = block_size - total_size;
-			if (remainder >= 2 * HEADER_SIZE + ALIGNMENT) {
-				set_header(curr, total_size, true);
-				set_header(curr + total_size - HEADER_SIZE, total_size, true);
-				set_header(curr + total_size, remainder, false);
-				set_header(curr + total_size + remainder - HEADER_SIZE, remainder, false);
-				return curr + HEADER_SIZE;
+// The current pool targets. Worked out once per prediction, so frees between
+// two allocations share them.
+static const int* pool_targets(ThreadCache& tc) {
+	if (!tc.caching) return NO_TARGETS;
+	if (tc.targets_stale) compute_targets(tc, tc.model);
+	return tc.targets;
+}
+
+static uint64_t pool_hits(const ThreadCache& tc) {
+	uint64_t hits = 0;
+	for (const std::atomic<uint64_t>& h : tc.stats->hits) hits += h.load(std::memory_order_relaxed);
+	return hits;
+}
+
+static void start_window(ThreadCache& tc, bool caching) {
+	tc.caching = caching;
+	tc.targets_stale = true;
+	tc.window_allocations = 0;
+	tc.window_predicted = 0;
+	tc.window_start_hits = pool_hits(tc);
+}
+
+// Ends a feedback window. It counts pool hits while caching, and correct
+// predictions, scaled up from the sample, while not. A thread that stops
+// caching hands its pooled blocks back on its next miss, and one that starts
+// again its reuse lists.
+static void adapt(ThreadCache& tc) {
+	uint64_t hits = tc.caching ? pool_hits(tc) - tc.window_start_hits : uint64_t(tc.window_predicted) * IDLE_SAMPLE;
+	bool paying = hits >= ADAPT_MIN_HIT_RATE * ADAPT_WINDOW;
+	start_window(tc, paying || !adaptive_caching.load(std::memory_order_relaxed));
+}
+
+// Whether the i-th allocation of a window is one a thread that is not pooling
+// learns from. The golden-ratio sequence picks one in IDLE_SAMPLE evenly
+// without a period, so a repeating pattern is not always sampled at the same
+// point.
+static bool idle_sampled(int i) {
+	return static_cast<uint32_t>(i) * 0x9e3779b1u < UINT32_MAX / IDLE_SAMPLE;
+}
+
+// Records an allocation of class c under caller tag ctx and moves the model's
+// prediction context past it (PredictionModel::observe). Only informed
+// predictions count towards turning pooling back on. A thread that is not
+// pooling skips the predictor's tables on all but a sample of allocations.
+//
+// The pools follow whichever model saw the thread's latest allocation. The
+// thread's own model is consulted again lazily; any other one right away,
+// since it may be gone by the next free.
+static void observe(ThreadCache& tc, PredictionModel& model, int c, uint32_t ctx) {
+	int order = predictor_order.load(std::memory_order_relaxed);
+	if (!tc.caching && !idle_sampled(tc.window_allocations)) {
+		model.follow(c, order, ctx);
+	} else {
+		Prediction predicted = model.predict();
+		if (predicted.state != -1) {
+			add_relaxed(tc.stats->predictions, uint64_t(1));
+			if (predicted.state == c) {
+				add_relaxed(tc.stats->prediction_hits, uint64_t(1));
+				if (predicted.informed) ++tc.window_predicted;
 			}
-			set_header(curr, block_size, true);
-			set_header(curr + block_size - HEADER_SIZE, block_size, true);
-			return curr + HEADER_SIZE;
 		}
-		curr += block_size;
-	}
-	
-	// If no block found, try coalescing and retry
-	coalesce_clean();
-	
-	// Retry allocation after coalescing
-	curr = heapStart;
-	while (curr < heapStart + HEAP_SIZE){
-		size_t header = *(reinterpret_cast<size_t*> (curr));
-		size_t block_size = get_block_size(header);
-		bool allocated = is_allocated(header);
-
-		if (!allocated && block_size >= total_size) {
-			size_t remainder = block_size - total_size;
-			if (remainder >= 2 * HEADER_SIZE + ALIGNMENT) {
-				set_header(curr, total_size, true);
-				set_header(curr + total_size - HEADER_SIZE, total_size, true);
-				set_header(curr + total_size, remainder, false);
-				set_header(curr + total_size + remainder - HEADER_SIZE, remainder, false);
-				return curr + HEADER_SIZE;
+		model.observe(c, order, ctx);
+	}
+
+	if (&model == &tc.model) {
+		tc.targets_stale = true;
+	} else {
+		compute_targets(tc, model);
+	}
+	if (++tc.window_allocations == ADAPT_WINDOW) adapt(tc);
+}
+
+static void pool_push(ThreadCache& tc, int c, char* block) {
+	Pool& pool = tc.pools[c];
+	pool.blocks[pool.count++] = block;
+	tc.cached_bytes += class_bytes(c, block);
+	tc.stats->pooled_bytes.store(tc.cached_bytes, std::memory_order_relaxed);
+}
+
+static char* pool_pop(ThreadCache& tc, int c) {
+	Pool& pool = tc.pools[c];
+	char* block = pool.blocks[--pool.count];
+	tc.cached_bytes -= class_bytes(c, block);
+	tc.stats->pooled_bytes.store(tc.cached_bytes, std::memory_order_relaxed);
+	return block;
+}
+
+// Frees a batch of allocated blocks, taking each owning shard's lock once and
+// coalescing each shard's share in one pass. Blocks from other shards are
+// compacted to the front and handled in the following rounds.
+static void release_blocks(char** blocks, int n) {
+	static_assert(DRAIN_BATCH <= BATCH_CHUNK, "a drain is released as one batch");
+	char* freeing[BATCH_CHUNK];
+	while (n > 0) {
+		// Huge blocks have no shard
+		if (arena_of(blocks[0])->owner == nullptr) {
+			huge_free(blocks[0]);
+			blocks[0] = blocks[--n];
+			continue;
+		}
+		Shard& owner = *arena_of(blocks[0])->owner;
+		std::lock_guard<std::mutex> guard(owner.lock);
+
+		int kept = 0, freed = 0;
+		for (int i = 0; i < n; ++i) {
+			if (arena_of(blocks[i])->owner != &owner) {
+				blocks[kept++] = blocks[i];
+			} else if (slab_of(blocks[i]) != nullptr) {
+				slab_free(owner, blocks[i]);
+			} else {
+				freeing[freed++] = blocks[i];
 			}
-			set_header(curr, block_size, true);
-			set_header(curr + block_size - HEADER_SIZE, block_size, true);
-			return curr + HEADER_SIZE;
 		}
-		curr += block_size;
+		shard_free_batch(owner, freeing, freed);
+		n = kept;
+	}
+}
+
+static void drain(ThreadCache& tc, char* block) {
+	tc.pending[tc.pending_count++] = block;
+	if (tc.pending_count == DRAIN_BATCH) {
+		trace::emit(TraceEvent::Drain, tc.pending_count);
+		release_blocks(tc.pending, tc.pending_count);
+		tc.pending_count = 0;
+	}
+}
+
+// Hands every block on the reuse lists to the drain buffer
+static void drain_reuse(ThreadCache& tc) {
+	for (ReuseList& list : tc.reuse) {
+		while (list.count > 0) drain(tc, list.blocks[--list.count]);
+	}
+	tc.reuse_bytes = 0;
+}
+
+// Drops pooled blocks above their class's target, then evicts from the
+// largest classes down until the pools fit in the budget.
+static void trim_pools(ThreadCache& tc, const int* targets) {
+	size_t budget = cache_budget.load(std::memory_order_relaxed);
+	for (int c = 0; c < POOL_CLASSES; ++c) {
+		while (tc.pools[c].count > targets[c]) drain(tc, pool_pop(tc, c));
+	}
+	for (int c = POOL_CLASSES - 1; c >= 0 && tc.cached_bytes > budget; --c) {
+		while (tc.pools[c].count > 0 && tc.cached_bytes > budget) drain(tc, pool_pop(tc, c));
+	}
+}
+
+// Locks the thread's home shard, or a nearby idle one if home is busy. Blocks
+// remember the shard that owns them, so it does not matter which one serves.
+static Shard& lock_shard(ThreadCache& tc) {
+	int home = static_cast<int>(tc.home - shards);
+	for (int i = 0; i < 4; ++i) {
+		Shard& shard = shards[(home + i) % NUM_SHARDS];
+		if (shard.lock.try_lock()) return shard;
+	}
+	tc.home->lock.lock();
+	return *tc.home;
+}
+
+// A slot of a slab class, or a block of total_size bytes for the others, from
+// a shard the caller has locked. `grow` is as for shard_alloc.
+static char* take_block(Shard& shard, int c, size_t total_size, bool grow) {
+	if (c >= SLAB_CLASSES) return shard_alloc(shard, total_size, grow);
+	char* slot;
+	return slab_alloc(shard, c, 1, &slot, grow) == 1 ? slot : nullptr;
+}
+
+// Carves blocks for the pools of the predicted next classes from the free
+// lists of a shard the caller has locked. For slab classes this is what
+// warms their slabs: slots come from partly used slabs first, and a new slab
+// is cut only for a class that is predicted. Carving writes block headers and
+// slab bitmaps, so first-touch faults happen here rather than on the fast
+// path; each payload is also prefetched for the write that will follow.
+static void top_up_pools(ThreadCache& tc, Shard& shard, const int* targets) {
+	size_t budget = cache_budget.load(std::memory_order_relaxed);
+	int carved = 0;
+	for (int c = 0; c < POOL_CLASSES; ++c) {
+		size_t size = SizeClasses::class_size(c);
+		while (tc.pools[c].count < targets[c] && tc.cached_bytes + size <= budget) {
+			char* spare = take_block(shard, c, size, false);
+			if (spare == nullptr) break;
+			__builtin_prefetch(spare + HEADER_SIZE, 1);
+			pool_push(tc, c, spare);
+			++carved;
+		}
+	}
+	if (carved > 0) trace::emit(TraceEvent::PoolRefill, carved);
+}
+
+// Slow path: carves the requested block and, under the same lock, tops up the
+// pools of the predicted next classes from the free lists. A huge block is
+// mapped on its own without locking a shard.
+static char* refill(ThreadCache& tc, int c, size_t total_size, const int* targets) {
+	if (is_huge_size(total_size)) return huge_alloc(total_size, ALIGNMENT);
+	Shard& shard = lock_shard(tc);
+	std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+
+	char* block = take_block(shard, c, total_size, true);
+	if (block == nullptr) return nullptr;
+	if (tc.caching) top_up_pools(tc, shard, targets);
+	return block;
+}
+
+ThreadCache::ThreadCache()
+	: home(&shards[next_home.fetch_add(1, std::memory_order_relaxed) % NUM_SHARDS]), stats(acquire_thread_stats()) {
+	const void* snapshot = profile.load(std::memory_order_acquire);
+	if (snapshot != nullptr) model.predictor.load(snapshot, MarkovPredictor::SNAPSHOT_SIZE);
+}
+
+ThreadCache::~ThreadCache() {
+	for (int c = 0; c < POOL_CLASSES; ++c) {
+		while (pools[c].count > 0) drain(*this, pool_pop(*this, c));
+	}
+	drain_reuse(*this);
+	release_blocks(pending, pending_count);
+	pending_count = 0;
+	release_thread_stats(stats);
+}
+
+static void destroy_cache(void* cache) {
+	// Frees from later destructors on this thread bypass the cache
+	cache_state = CacheState::Gone;
+	static_cast<ThreadCache*>(cache)->~ThreadCache();
+}
+
+// The calling thread's cache, or nullptr while it is being built (its setup
+// may allocate) and after the thread has torn it down.
+static ThreadCache* thread_cache() {
+	if (cache_state == CacheState::Ready) [[likely]] return reinterpret_cast<ThreadCache*>(cache_storage);
+	if (cache_state != CacheState::Fresh) return nullptr;
+
+	cache_state = CacheState::Building;
+	pthread_once(&cache_key_once, [] { pthread_key_create(&cache_key, destroy_cache); });
+	ThreadCache* tc = new (cache_storage) ThreadCache();
+	pthread_setspecific(cache_key, tc);
+	cache_state = CacheState::Ready;
+	return tc;
+}
+
+// Allocation and free without a thread cache: straight to a shard, with no
+// pools or prediction.
+static void* allocate_uncached(size_t request_size, size_t alignment = ALIGNMENT) {
+	Shard& shard = shards[0];
+	size_t total_size = block_size_for(request_size);
+	char* block;
+	if (is_huge_size(total_size) && alignment <= ARENA_SIZE) {
+		block = huge_alloc(total_size, alignment);
+	} else {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		block = alignment > ALIGNMENT ? shard_alloc_aligned(shard, total_size, alignment) : shard_alloc(shard, total_size, true);
+	}
+	if (block == nullptr) return nullptr;
+
+	ThreadStats* stats = shared_thread_stats();
+	stats->misses[size_class(request_size)].fetch_add(1, std::memory_order_relaxed);
+	stats->allocated_bytes.fetch_add(block_size_of(block), std::memory_order_relaxed);
+	return block + HEADER_SIZE;
+}
+
+static void deallocate_uncached(char* block) {
+	ThreadStats* stats = shared_thread_stats();
+	stats->frees.fetch_add(1, std::memory_order_relaxed);
+	stats->freed_bytes.fetch_add(block_bytes(block), std::memory_order_relaxed);
+	release_blocks(&block, 1);
+}
+
+void drain_pending() {
+	ThreadCache* tc = thread_cache();
+	if (tc == nullptr) return;
+	drain_reuse(*tc);
+	release_blocks(tc->pending, tc->pending_count);
+	tc->pending_count = 0;
+}
+
+void set_cache_budget(size_t bytes) {
+	cache_budget.store(bytes, std::memory_order_relaxed);
+	ThreadCache* tc = thread_cache();
+	if (tc == nullptr) return;
+	trim_pools(*tc, pool_targets(*tc));
+}
+
+void set_prediction_threshold(float min_probability) {
+	prediction_threshold.store(std::clamp(min_probability, 0.0f, 1.0f), std::memory_order_relaxed);
+	// Other threads pick the threshold up on their next miss
+	ThreadCache* tc = thread_cache();
+	if (tc == nullptr) return;
+	std::fill(tc->lookahead, tc->lookahead + POOL_CLASSES, 0);
+	tc->lookahead_set = false;
+	tc->targets_stale = true;
+}
+
+void set_adaptive_caching(bool adaptive) {
+	adaptive_caching.store(adaptive, std::memory_order_relaxed);
+	ThreadCache* tc = thread_cache();
+	if (tc != nullptr && !adaptive && !tc->caching) start_window(*tc, true);
+}
+
+void set_predictor_order(int order) {
+	predictor_order.store(std::clamp(order, 1, MAX_PREDICTOR_ORDER), std::memory_order_relaxed);
+}
+
+bool save_prediction_profile(const char* path, const PredictionModel* model) {
+	if (model == nullptr) {
+		ThreadCache* cache = thread_cache();
+		if (cache == nullptr) return false;
+		model = &cache->model;
+	}
+	return model->predictor.save(path);
+}
+
+bool load_prediction_profile(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	void* mem = mmap(nullptr, MarkovPredictor::SNAPSHOT_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	bool ok = mem != MAP_FAILED && lseek(fd, 0, SEEK_END) == static_cast<off_t>(MarkovPredictor::SNAPSHOT_SIZE)
+	          && MarkovPredictor::check_snapshot(mem, MarkovPredictor::SNAPSHOT_SIZE);
+	close(fd);
+	if (!ok) {
+		if (mem != MAP_FAILED) munmap(mem, MarkovPredictor::SNAPSHOT_SIZE);
+		return false;
+	}
+
+	// A profile loaded earlier stays mapped for threads that may be reading it
+	profile.store(mem, std::memory_order_release);
+	ThreadCache* tc = thread_cache();
+	if (tc != nullptr) {
+		tc->model.predictor.load(mem, MarkovPredictor::SNAPSHOT_SIZE);
+		tc->targets_stale = true;
+	}
+	return true;
+}
+
+size_t context_hit_rates(ContextHitRate* out, size_t n, const PredictionModel* model) {
+	if (model == nullptr) {
+		ThreadCache* cache = thread_cache();
+		if (cache == nullptr) return 0;
+		model = &cache->model;
+	}
+	ContextHitRate found[POOL_CLASSES + ContextPredictor::TABLE_SIZE];
+	size_t count = 0;
+
+	for (int c = 0; c < POOL_CLASSES; ++c) {
+		PredictionStats stats = model->predictor.stats(c);
+		if (stats.predictions > 0) found[count++] = {static_cast<uint64_t>(c + 1), stats.predictions, stats.hits};
+	}
+	for (int slot = 0; slot < ContextPredictor::TABLE_SIZE; ++slot) {
+		uint64_t context = model->contexts.context_at(slot);
+		PredictionStats stats = model->contexts.stats_at(slot);
+		if (context != 0 && stats.predictions > 0) found[count++] = {context, stats.predictions, stats.hits};
+	}
+
+	n = std::min(n, count);
+	std::partial_sort(found, found + n, found + count, [](const ContextHitRate& a, const ContextHitRate& b) {
+		return a.predictions > b.predictions;
+	});
+	std::copy(found, found + n, out);
+	return n;
+}
+
+// model is nullptr to predict from the thread's own model
+static void* do_allocate(size_t request_size, uint32_t ctx, PredictionModel* model) {
+	if (request_size == 0) return nullptr;
+	if (request_size > SIZE_MAX / 2) return nullptr;
+
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) return allocate_uncached(request_size);
+	ThreadCache& tc = *cache;
+	size_t total_size = block_size_for(request_size);
+	int c = size_class(request_size);
+
+	// Update the predictors and move to the next context
+	PredictionModel& predicting = model != nullptr ? *model : tc.model;
+	observe(tc, predicting, c, ctx);
+
+	// Check the pool for this class first
+	if (c < POOL_CLASSES && tc.pools[c].count > 0) {
+		trace::emit(TraceEvent::CacheHit, request_size);
+		add_relaxed(tc.stats->hits[c], uint64_t(1));
+		char* block = pool_pop(tc, c);
+		add_relaxed(tc.stats->allocated_bytes, uint64_t(class_bytes(c, block)));
+		return block + HEADER_SIZE;
+	}
+
+	trace::emit(TraceEvent::CacheMiss, request_size);
+	add_relaxed(tc.stats->misses[c], uint64_t(1));
+
+	// A thread that is not caching serves a class from its own recent frees
+	// of it before locking a shard
+	if (c < POOL_CLASSES && tc.reuse[c].count > 0) {
+		char* block = tc.reuse[c].blocks[--tc.reuse[c].count];
+		size_t size = class_bytes(c, block);
+		tc.reuse_bytes -= size;
+		add_relaxed(tc.stats->allocated_bytes, uint64_t(size));
+		return block + HEADER_SIZE;
+	}
+
+	// Look further ahead, so the refill below pre-carves the classes after
+	// the next one too, then give back pooled blocks the new prediction no
+	// longer wants. Targets from a model other than the thread's own are
+	// worked out here, as observe() did for them. A thread caching again
+	// first hands back its reuse lists; one that is not caching only hands
+	// back what it still pools.
+	const int* targets = NO_TARGETS;
+	if (tc.caching) {
+		if (tc.reuse_bytes > 0) drain_reuse(tc);
+		compute_lookahead(tc, predicting);
+		if (tc.targets_stale && &predicting != &tc.model) compute_targets(tc, predicting);
+		targets = pool_targets(tc);
+		trim_pools(tc, targets);
+	} else if (tc.cached_bytes > 0) {
+		trim_pools(tc, targets);
+	}
+
+	char* block = refill(tc, c, total_size, targets);
+	if (block == nullptr) return nullptr;
+	add_relaxed(tc.stats->allocated_bytes, uint64_t(class_bytes(c, block)));
+	return block + HEADER_SIZE;
+}
+
+void* allocate(size_t request_size) {
+	return allocate(request_size, 0);
+}
+
+void* allocate(size_t request_size, uint32_t ctx) {
+	void* ptr = do_allocate(request_size, ctx, nullptr);
+	if (recording()) record_event(RecordOp::Allocate, request_size, ptr, ctx);
+	return ptr;
+}
+
+void* allocate(size_t request_size, PredictionModel& model) {
+	void* ptr = do_allocate(request_size, 0, &model);
+	if (recording()) record_event(RecordOp::Allocate, request_size, ptr, 0);
+	return ptr;
+}
+
+// Models live in heap blocks the predictors never see, so creating one does
+// not disturb the pattern of the thread that does it.
+PredictionModel* create_prediction_model() {
+	void* mem = allocate_unobserved(sizeof(PredictionModel));
+	return mem != nullptr ? new (mem) PredictionModel() : nullptr;
+}
+
+void destroy_prediction_model(PredictionModel* model) {
+	if (model == nullptr) return;
+	model->~PredictionModel();
+	deallocate(model);
+}
+
+// Takes a pooled block of class c whose payload happens to be aligned, or
+// returns nullptr if there is none.
+static char* pool_take_aligned(ThreadCache& tc, int c, size_t alignment) {
+	Pool& pool = tc.pools[c];
+	for (int i = 0; i < pool.count; ++i) {
+		if ((reinterpret_cast<uintptr_t>(pool.blocks[i]) + HEADER_SIZE) % alignment == 0) {
+			std::swap(pool.blocks[i], pool.blocks[pool.count - 1]);
+			return pool_pop(tc, c);
+		}
 	}
-	
 	return nullptr;
 }
 
-void coalesce_one(char* block) {
-    if (!block) return;
-    
-    size_t block_size = get_block_size(*(reinterpret_cast<size_t*>(block)));
-    
-    // Try to cache the block first
-    if (validate_and_set_cache(block + HEADER_SIZE, cache_guess)) {
-        std::cout << "Caching block of size " << (1 << cache_guess) << " for predicted reuse" << std::endl;
-        return;
-    }
-    
-    // Coalesce with next block
-    if (block + block_size < heapStart + heapSize) {
-        char* next_header = block + block_size;
-        size_t next_size = get_block_size(*(reinterpret_cast<size_t*>(next_header)));
-        bool next_allocated = is_allocated(*(reinterpret_cast<size_t*>(next_header)));
-        
-        if (!next_allocated) {
-            size_t new_size = block_size + next_size;
-            set_header(block, new_size, false);
-            set_header(block + new_size - HEADER_SIZE, new_size, false);
-            
-            // Try to cache the coalesced block
-            if (validate_and_set_cache(block + HEADER_SIZE, cache_guess)) {
-                std::cout << "Caching coalesced block of size " << (1 << cache_guess) << " for predicted reuse" << std::endl;
-                return;
-            }
-        }
-    }
-    
-    // Coalesce with previous block
-    if (block != heapStart) {
-        char* prev_footer = block - HEADER_SIZE;
-        size_t prev_size = get_block_size(*(reinterpret_cast<size_t*>(prev_footer)));
-        bool prev_allocated = is_allocated(*(reinterpret_cast<size_t*>(prev_footer)));
-        
-        if (!prev_allocated) {
-            char* prev_block = prev_footer - prev_size + HEADER_SIZE;
-            size_t new_size = prev_size + block_size;
-            set_header(prev_block, new_size, false);
-            set_header(prev_block + new_size - HEADER_SIZE, new_size, false);
-            
-            // Try to cache the coalesced block
-            if (validate_and_set_cache(prev_block + HEADER_SIZE, cache_guess)) {
-                std::cout << "Caching coalesced block of size " << (1 << cache_guess) << " for predicted reuse" << std::endl;
-                return;
-            }
-        }
-    }
-}
-
-void coalesce_clean() {
-    char* curr = heapStart;
-    
-    while (curr < heapStart + heapSize) {
-        size_t header = *(reinterpret_cast<size_t*>(curr));
-        size_t block_size = get_block_size(header);
-        bool allocated = is_allocated(header);
-        
-        if (!allocated) {
-            coalesce_one(curr);
-        }
-        
-        curr += block_size;
-    }
+static void* do_aligned_allocate(size_t request_size, size_t alignment) {
+	if (request_size == 0) return nullptr;
+	if (request_size > SIZE_MAX / 4 || alignment > SIZE_MAX / 4) return nullptr;
+
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) return allocate_uncached(request_size, alignment);
+	ThreadCache& tc = *cache;
+	int c = size_class(request_size);
+	observe(tc, tc.model, c, 0);
+
+	// Slab slots are not cut for alignments, so small requests take a block
+	char* block = c >= SLAB_CLASSES && c < POOL_CLASSES ? pool_take_aligned(tc, c, alignment) : nullptr;
+	if (block != nullptr) {
+		add_relaxed(tc.stats->hits[c], uint64_t(1));
+	} else {
+		add_relaxed(tc.stats->misses[c], uint64_t(1));
+		const int* targets = pool_targets(tc);
+		trim_pools(tc, targets);
+
+		size_t total_size = block_size_for(request_size);
+		if (is_huge_size(total_size) && alignment <= ARENA_SIZE) {
+			block = huge_alloc(total_size, alignment);
+		} else {
+			Shard& shard = lock_shard(tc);
+			std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+			block = shard_alloc_aligned(shard, total_size, alignment);
+			if (block != nullptr) top_up_pools(tc, shard, targets);
+		}
+		if (block == nullptr) return nullptr;
+	}
+	add_relaxed(tc.stats->allocated_bytes, uint64_t(block_size_of(block)));
+	return block + HEADER_SIZE;
+}
+
+void* aligned_allocate(size_t request_size, size_t alignment) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) return nullptr;
+	if (alignment <= ALIGNMENT) return allocate(request_size);
+
+	void* ptr = do_aligned_allocate(request_size, alignment);
+	if (recording()) record_event(RecordOp::Allocate, request_size, ptr, 0, std::countr_zero(alignment));
+	return ptr;
+}
+
+// c is the largest class the block serves in full, or -1 to work it out from
+// the block's size.
+static void do_deallocate(char* block, int c) {
+	Slab* slab = slab_of(block);
+	size_t header = slab != nullptr ? 0 : shared_header(block).load(std::memory_order_relaxed);
+	size_t size = slab != nullptr ? slab->slot_size : get_block_size(header);
+
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) {
+		deallocate_uncached(block);
+		return;
+	}
+	ThreadCache& tc = *cache;
+	add_relaxed(tc.stats->frees, uint64_t(1));
+	add_relaxed(tc.stats->freed_bytes, uint64_t(size));
+
+	// Huge blocks and oversized arenas go straight back so their mapping is
+	// released (or cached) now, and so do blocks large enough that a drain
+	// batch of them would hold several arenas' worth of memory out of reach
+	if (slab == nullptr && (is_huge(header) || arena_of(block)->size != ARENA_SIZE || size >= DIRECT_FREE_SIZE)) {
+		release_blocks(&block, 1);
+		return;
+	}
+
+	// The class the block serves in full: a block left unsplit may be a little
+	// larger than its class size. Pools of slab classes only take slots.
+	if (c < 0) c = slab != nullptr ? slab->cls : SizeClasses::floor_class(size);
+	bool poolable = (slab != nullptr || c >= SLAB_CLASSES) && c < POOL_CLASSES;
+	size_t budget = cache_budget.load(std::memory_order_relaxed);
+
+	// Without pooling, a thread keeps its latest frees of each class for
+	// itself, as a plain allocator's thread cache does: no prediction, no
+	// shard lock and no coalescing
+	if (!tc.caching) {
+		if (poolable && tc.reuse[c].count < REUSE_DEPTH && tc.reuse_bytes + size <= budget) {
+			tc.reuse[c].blocks[tc.reuse[c].count++] = block;
+			tc.reuse_bytes += size;
+		} else {
+			drain(tc, block);
+		}
+		return;
+	}
+
+	// Predict the next allocation sizes and how many blocks each deserves
+	const int* targets = pool_targets(tc);
+	if constexpr (TRACE_ENABLED) {
+		int state = tc.model.prev_class;
+		float prob;
+		tc.model.predict_top(1, &state, &prob);
+		trace::emit(TraceEvent::Predict, state, size);
+	}
+
+	// Keep the freed block if its class is predicted and its pool has room
+	if (poolable && tc.pools[c].count < targets[c] && tc.cached_bytes + size <= budget) {
+		trace::emit(TraceEvent::PoolPush, c, size);
+		pool_push(tc, c, block);
+		return;
+	}
+
+	// Otherwise queue it for its shard, which frees and coalesces it
+	drain(tc, block);
 }
 
 void deallocate(void* ptr){
 	if (ptr == nullptr) return;
-	
-	// Mark block as free
-	char* block = reinterpret_cast<char*>(ptr) - HEADER_SIZE;
-	size_t size = get_block_size(*(reinterpret_cast<size_t*>(block)));
-	set_header(block, size, false);
-	set_header(block + size - HEADER_SIZE, size, false);
-	
-	// Predict next allocation size
-	cache_guess = pow(2, predictor.predict(log2(prev_guess)));
-	std::cout << "Predicted next allocation size: " << cache_guess << std::endl;
-	
-	// Try to cache the freed block
-	if (validate_and_set_cache(ptr, cache_guess)) {
-		std::cout << "Caching freed block for predicted reuse" << std::endl;
-		return;
+	if (recording()) record_event(RecordOp::Deallocate, 0, ptr, 0);
+	do_deallocate(reinterpret_cast<char*>(ptr) - HEADER_SIZE, -1);
+}
+
+// The block is at least the class size of the request it was allocated for,
+// so that class is one it serves in full.
+void deallocate_sized(void* ptr, size_t size) {
+	if (ptr == nullptr) return;
+	if (recording()) record_event(RecordOp::Deallocate, 0, ptr, 0);
+	do_deallocate(reinterpret_cast<char*>(ptr) - HEADER_SIZE, size_class(size));
+}
+
+static size_t do_allocate_batch(size_t request_size, size_t n, void** out) {
+	if (request_size == 0 || request_size > SIZE_MAX / 2) return 0;
+
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) {
+		size_t done = 0;
+		while (done < n && (out[done] = allocate_uncached(request_size)) != nullptr) ++done;
+		return done;
+	}
+	ThreadCache& tc = *cache;
+	size_t total_size = block_size_for(request_size);
+	int c = size_class(request_size);
+
+	// The whole batch is one transition for the predictors
+	observe(tc, tc.model, c, 0);
+
+	size_t done = 0;
+	uint64_t bytes = 0;
+	while (done < n && c < POOL_CLASSES && tc.pools[c].count > 0) {
+		char* block = pool_pop(tc, c);
+		bytes += class_bytes(c, block);
+		out[done++] = block + HEADER_SIZE;
 	}
-	
-	// Try to cache adjacent blocks
-	if (block + size < heapStart + heapSize) {
-		char* next_header = block + size;
-		if (validate_and_set_cache(next_header + HEADER_SIZE, cache_guess)) {
-			std::cout << "Caching next block for predicted reuse" << std::endl;
-			return;
+	add_relaxed(tc.stats->hits[c], uint64_t(done));
+
+	if (done < n && is_huge_size(total_size)) {
+		// Huge blocks are mapped one by one, with no shard lock
+		size_t from_pool = done;
+		while (done < n) {
+			char* block = huge_alloc(total_size, ALIGNMENT);
+			if (block == nullptr) break;
+			bytes += class_bytes(c, block);
+			out[done++] = block + HEADER_SIZE;
+		}
+		add_relaxed(tc.stats->misses[c], uint64_t(done - from_pool));
+	} else if (done < n) {
+		const int* targets = pool_targets(tc);
+		trim_pools(tc, targets);
+
+		// The rest is carved under a single lock, in runs cut from as few free
+		// blocks as possible
+		Shard& shard = lock_shard(tc);
+		std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+		size_t from_pool = done;
+		char* blocks[BATCH_CHUNK];
+		while (done < n) {
+			size_t want = std::min(n - done, size_t(BATCH_CHUNK));
+			size_t got = c < SLAB_CLASSES ? slab_alloc(shard, c, want, blocks, true) : shard_alloc_batch(shard, total_size, want, blocks);
+			for (size_t i = 0; i < got; ++i) {
+				bytes += class_bytes(c, blocks[i]);
+				out[done++] = blocks[i] + HEADER_SIZE;
+			}
+			if (got < want) break;
 		}
+		add_relaxed(tc.stats->misses[c], uint64_t(done - from_pool));
+		top_up_pools(tc, shard, targets);
 	}
-	
-	if (block != heapStart) {
-		char* prev_footer = block - HEADER_SIZE;
-		size_t prev_size = get_block_size(*(reinterpret_cast<size_t*>(prev_footer)));
-		char* prev_block = prev_footer - prev_size + HEADER_SIZE;
-		if (validate_and_set_cache(prev_block + HEADER_SIZE, cache_guess)) {
-			std::cout << "Caching previous block for predicted reuse" << std::endl;
-			return;
+
+	add_relaxed(tc.stats->allocated_bytes, bytes);
+	return done;
+}
+
+size_t allocate_batch(size_t request_size, size_t n, void** out) {
+	size_t done = do_allocate_batch(request_size, n, out);
+	if (recording()) {
+		for (size_t i = 0; i < done; ++i) record_event(RecordOp::Allocate, request_size, out[i], 0);
+	}
+	return done;
+}
+
+void deallocate_batch(void** ptrs, size_t n) {
+	if (recording()) {
+		for (size_t i = 0; i < n; ++i) {
+			if (ptrs[i] != nullptr) record_event(RecordOp::Deallocate, 0, ptrs[i], 0);
 		}
 	}
-	
-	// If no caching possible, coalesce
-	coalesce_one(block);
-	cache_guess = 0;
-	cache_ptr = nullptr;
+
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) {
+		for (size_t i = 0; i < n; ++i) {
+			if (ptrs[i] != nullptr) deallocate_uncached(reinterpret_cast<char*>(ptrs[i]) - HEADER_SIZE);
+		}
+		return;
+	}
+	ThreadCache& tc = *cache;
+
+	// One prediction for the whole batch. Blocks the pools do not want skip
+	// the drain buffer and go back to their shards together, one lock per
+	// shard for each chunk.
+	const int* targets = pool_targets(tc);
+	size_t budget = cache_budget.load(std::memory_order_relaxed);
+	char* spill[BATCH_CHUNK];
+	int spilled = 0;
+	uint64_t frees = 0, bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (ptrs[i] == nullptr) continue;
+		char* block = reinterpret_cast<char*>(ptrs[i]) - HEADER_SIZE;
+		Slab* slab = slab_of(block);
+		size_t header = slab != nullptr ? 0 : shared_header(block).load(std::memory_order_relaxed);
+		size_t size = slab != nullptr ? slab->slot_size : get_block_size(header);
+		++frees;
+		bytes += size;
+
+		int c = slab != nullptr ? slab->cls : SizeClasses::floor_class(size);
+		bool poolable = slab != nullptr || (c >= SLAB_CLASSES && !is_huge(header) && arena_of(block)->size == ARENA_SIZE);
+		if (poolable && c < POOL_CLASSES && tc.pools[c].count < targets[c] && tc.cached_bytes + size <= budget) {
+			pool_push(tc, c, block);
+			continue;
+		}
+		spill[spilled++] = block;
+		if (spilled == BATCH_CHUNK) {
+			trace::emit(TraceEvent::Drain, spilled);
+			release_blocks(spill, spilled);
+			spilled = 0;
+		}
+	}
+	if (spilled > 0) {
+		trace::emit(TraceEvent::Drain, spilled);
+		release_blocks(spill, spilled);
+	}
+
+	add_relaxed(tc.stats->frees, frees);
+	add_relaxed(tc.stats->freed_bytes, bytes);
+}
+
+// Counts the bytes a block gained or lost by being resized in place
+static void count_resize(size_t old_size, size_t new_size) {
+	ThreadCache* tc = thread_cache();
+	if (tc == nullptr) {
+		ThreadStats* stats = shared_thread_stats();
+		if (new_size > old_size) stats->allocated_bytes.fetch_add(new_size - old_size, std::memory_order_relaxed);
+		if (new_size < old_size) stats->freed_bytes.fetch_add(old_size - new_size, std::memory_order_relaxed);
+		return;
+	}
+	if (new_size > old_size) add_relaxed(tc->stats->allocated_bytes, uint64_t(new_size - old_size));
+	if (new_size < old_size) add_relaxed(tc->stats->freed_bytes, uint64_t(old_size - new_size));
 }
 
-void print_heap() {
-	std::cout << "Heap state:\n";
-	char* curr = heapStart;
-	size_t offset = 0;
+// The in-place half of reallocate(): resizes the block under its shard's lock,
+// or returns false if it has to move.
+static bool resize_in_place(void* ptr, size_t request_size) {
+	if (request_size == 0 || request_size > SIZE_MAX / 2) return false;
+
+	char* block = reinterpret_cast<char*>(ptr) - HEADER_SIZE;
+	if (Slab* slab = slab_of(block)) return request_size <= slab->slot_size;
+	size_t header = shared_header(block).load(std::memory_order_relaxed);
+	size_t old_size = get_block_size(header);
+	size_t total_size = block_size_for(request_size);
+	Arena* arena = arena_of(block);
+
+	// A huge block or an oversized arena is one block that is never split; it
+	// stays put only while the request still needs most of it
+	if (is_huge(header) || arena->size != ARENA_SIZE) return total_size <= old_size && total_size > old_size / 2;
 
-	while (curr < heapStart + HEAP_SIZE) {
-		size_t header = *((size_t*) curr);
-		size_t block_size = get_block_size(header);
-		bool allocated = is_allocated(header);
+	// Shrinking by less than a block leaves nothing to split off
+	if (total_size <= old_size && old_size - total_size < MIN_BLOCK_SIZE) return true;
+
+	{
+		std::lock_guard<std::mutex> guard(arena->owner->lock);
+		if (!shard_resize(*arena->owner, block, total_size)) return false;
+	}
+	count_resize(old_size, block_size_of(block));
+	return true;
+}
 
-		std::cout << "Block at offset " << offset
-		          << " | Size: " << block_size
-		          << " | Allocated: " << (allocated ? "Yes" : "No") << "\n";
+// Also used for a reallocation that has to move. A pooled block of the class
+// is still taken if there is one.
+void* allocate_unobserved(size_t request_size) {
+	ThreadCache* cache = thread_cache();
+	if (cache == nullptr) return allocate_uncached(request_size);
+	ThreadCache& tc = *cache;
+	int c = size_class(request_size);
 
-		if (block_size == 0 || block_size % ALIGNMENT != 0) {
-			std::cerr << "Error: Invalid block size at offset " << offset << "\n";
-			break;
+	char* block;
+	if (c < POOL_CLASSES && tc.pools[c].count > 0) {
+		add_relaxed(tc.stats->hits[c], uint64_t(1));
+		block = pool_pop(tc, c);
+	} else {
+		add_relaxed(tc.stats->misses[c], uint64_t(1));
+		size_t total_size = block_size_for(request_size);
+		if (is_huge_size(total_size)) {
+			block = huge_alloc(total_size, ALIGNMENT);
+		} else {
+			Shard& shard = lock_shard(tc);
+			std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+			block = take_block(shard, c, total_size, true);
 		}
-		curr += block_size;
-		offset = curr - heapStart;
+		if (block == nullptr) return nullptr;
 	}
-	std::cout << std::endl;
+	add_relaxed(tc.stats->allocated_bytes, uint64_t(class_bytes(c, block)));
+	return block + HEADER_SIZE;
 }
 
+static void* do_reallocate(void* ptr, size_t request_size) {
+	if (resize_in_place(ptr, request_size)) return ptr;
+	if (request_size > SIZE_MAX / 2) return nullptr;
+
+	// Last resort: move the contents
+	void* moved = allocate_unobserved(request_size);
+	if (moved == nullptr) return nullptr;
+	char* block = reinterpret_cast<char*>(ptr) - HEADER_SIZE;
+	Slab* slab = slab_of(block);
+	size_t old_payload = slab != nullptr ? slab->slot_size : block_size_of(block) - HEADER_SIZE;
+	std::memcpy(moved, ptr, std::min(old_payload, request_size));
+	do_deallocate(block, -1);
+	return moved;
+}
+
+void* reallocate(void* ptr, size_t request_size) {
+	if (ptr == nullptr) return allocate(request_size);
+	if (request_size == 0) {
+		deallocate(ptr);
+		return nullptr;
+	}
+
+	if (recording()) record_event(RecordOp::Reallocate, request_size, ptr, 0);
+	void* result = do_reallocate(ptr, request_size);
+	if (recording()) record_event(RecordOp::ReallocateResult, 0, result, 0);
+	return result;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "SizeClass.h"
+
+// Block layout and back-end interface shared by the translation units of the
+// allocator. Not part of the public API.
+
+constexpr size_t ARENA_SIZE = 1 << 20;
+// Payloads are aligned to 16 bytes, enough for max_align_t and SSE types, so
+// blocks start 8 bytes short of a multiple of 16 and their sizes are
+// multiples of 16.
+constexpr size_t ALIGNMENT = 16;
+constexpr size_t HEADER_SIZE = sizeof(size_t);
+
+// A block is its header, holding the size and the flags below, then the
+// payload. Only free blocks also end in a footer, a copy of the size, so an
+// allocated block gives all but its header to the payload; the block after
+// a free one has PREV_FREE set, which tells coalescing the footer is there.
+// HUGE_BLOCK marks a block with a mapping of its own, outside every shard.
+constexpr size_t ALLOCATED = 1;
+constexpr size_t PREV_FREE = 2;
+constexpr size_t HUGE_BLOCK = 4;
+
+constexpr int NUM_SHARDS = 16;
+
+// The size classes shared by the pools, the free lists and the predictor. They
+// are the bytes an allocation takes: a slab slot for the classes up to
+// SLAB_MAX, and above that a block, so a request is classed together with its
+// header.
+using SizeClasses = DefaultSizeClasses;
+
+// Slabs serve the smallest classes: SLAB_SIZE bytes of equal slots with no
+// per-object header, whose free slots are found in a bitmap. A slab is one
+// heap block with its payload aligned to SLAB_SIZE, and the arena marks the
+// pages holding slabs, so any pointer can be checked with arena_of().
+constexpr size_t SLAB_SIZE = 4096;
+constexpr size_t SLAB_MAX = 64;
+constexpr int SLAB_CLASSES = SizeClasses::class_of(SLAB_MAX) + 1;
+constexpr int SLAB_PAGES = ARENA_SIZE / SLAB_SIZE;
+static_assert(SizeClasses::class_size(SLAB_CLASSES - 1) == SLAB_MAX, "SLAB_MAX must be a class size");
+
+// Free blocks are kept on explicit doubly linked lists threaded through their
+// payload: one bin per size class, then one per power of two above the largest
+// class. A block is filed under the largest bin it can satisfy in full, so any
+// block in bin b or above fits a block whose fit_bin() is b.
+constexpr int LARGE_SHIFT = std::countr_zero(SizeClasses::MAX_SIZE);
+constexpr int NUM_BINS = SizeClasses::NUM_CLASSES + 8 * sizeof(size_t) - 1 - LARGE_SHIFT;
+struct FreeNode {
+	FreeNode* prev;
+	FreeNode* next;
+};
+
+constexpr size_t MIN_BLOCK_SIZE = 2 * HEADER_SIZE + sizeof(FreeNode);
+
+struct Shard;
+
+// Each arena is one mmap'd chunk aligned to ARENA_SIZE and laid out as
+//   [Arena][padding][block]...[block][epilogue header]
+// with the first block `first` bytes in. Regular arenas start it right after
+// the header; an oversized arena mapped for an aligned request moves it so
+// its payload is aligned.
+// The epilogue is a zero-sized allocated header, so block walks stop at the
+// arena end without range checks; the first block never has PREV_FREE set.
+// Arenas larger than ARENA_SIZE hold a single block that is never split, so
+// every block starts within the first ARENA_SIZE bytes of its arena and
+// arena_of() can find it by masking. Huge mappings are laid out the same way,
+// with no owner and no epilogue.
+struct Arena {
+	Arena* next;
+	size_t size;
+	Shard* owner;
+	size_t first;
+	std::atomic<uint64_t> slab_pages[SLAB_PAGES / 64];  // set under the owner's lock, read without it
+};
+
+constexpr size_t ARENA_HEADER_SIZE = (sizeof(Arena) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+// Header at the start of a slab's payload, followed by its slots. Slabs with
+// a free slot are kept on their shard's list for the class.
+struct Slab {
+	Slab* prev;
+	Slab* next;
+	uint32_t slot_size;
+	uint16_t slots;
+	uint16_t free_count;
+	int cls;
+	uint64_t free_slots[4];  // a set bit is a free slot
+};
+
+// One independently locked heap. Threads refill from and drain to shards in
+// batches; a block always goes back to the shard that owns its arena.
+struct Shard {
+	std::mutex lock;
+	Arena* arenas = nullptr;  // primary arena first; it is never unmapped
+	FreeNode* free_lists[NUM_BINS] = {};
+	uint64_t bin_map[(NUM_BINS + 63) / 64] = {};  // a set bit is a non-empty bin
+	Slab* slabs[SLAB_CLASSES] = {};  // slabs with free slots
+
+	// Deferred coalescing: freed blocks parked by class, still marked
+	// allocated, and linked through their payload
+	char* parked[SizeClasses::NUM_CLASSES] = {};
+	size_t parked_count = 0;
+	size_t frees_since_merge = 0;
+	int merge_cursor = 0;  // class the next merge step starts from
+
+	// For get_heap_stats(): written under lock, read without it
+	std::atomic<size_t> free_bytes{0};
+	std::atomic<size_t> free_blocks{0};
+	std::atomic<size_t> largest_free{0};
+	std::atomic<size_t> mapped_bytes{0};
+	std::atomic<uint64_t> coalesces{0};
+	std::atomic<size_t> parked_bytes{0};
+};
+
+// Per-thread counters. Only the owning thread writes them, so increments are
+// plain load/store pairs; get_heap_stats() sums every slot ever handed out.
+// Slots are reused by later threads but never reset, so the sums stay
+// cumulative.
+struct ThreadStats {
+	std::atomic<uint64_t> hits[SizeClasses::NUM_CLASSES + 1];  // last: larger than every class
+	std::atomic<uint64_t> misses[SizeClasses::NUM_CLASSES + 1];
+	std::atomic<uint64_t> frees;
+	std::atomic<uint64_t> allocated_bytes;
+	std::atomic<uint64_t> freed_bytes;
+	std::atomic<uint64_t> predictions;
+	std::atomic<uint64_t> prediction_hits;
+	std::atomic<size_t> pooled_bytes;
+	std::atomic<bool> in_use;
+	ThreadStats* next;
+};
+
+extern Shard shards[NUM_SHARDS];
+
+inline bool is_allocated(size_t header) {
+	return header & ALLOCATED;
+}
+
+inline bool is_prev_free(size_t header) {
+	return header & PREV_FREE;
+}
+
+inline bool is_huge(size_t header) {
+	return header & HUGE_BLOCK;
+}
+
+inline size_t get_block_size(size_t header) {
+	return header & ~(ALIGNMENT - 1);
+}
+
+// An allocated block's header, read by the thread that owns the block without
+// the shard lock. A neighbour freed under the lock may flip PREV_FREE in it
+// meanwhile, so both sides access it as a relaxed atomic.
+inline std::atomic_ref<size_t> shared_header(char* block) {
+	return std::atomic_ref<size_t>(*reinterpret_cast<size_t*>(block));
+}
+
+inline size_t block_size_of(char* block) {
+	return get_block_size(shared_header(block).load(std::memory_order_relaxed));
+}
+
+inline size_t align(size_t size) {
+	return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+// Class of a request; SizeClasses::NUM_CLASSES if it is larger than them all
+inline int size_class(size_t size) {
+	return size <= SLAB_MAX ? SizeClasses::class_of(size) : SizeClasses::class_of(size + HEADER_SIZE);
+}
+
+// Lowest bin whose blocks are all at least this big
+inline int fit_bin(size_t block_size) {
+	if (block_size <= SizeClasses::MAX_SIZE) return SizeClasses::class_of(block_size);
+	return SizeClasses::NUM_CLASSES - 1 + std::bit_width(block_size - 1) - LARGE_SHIFT;
+}
+
+// Bin a free block is filed under
+inline int free_bin(size_t block_size) {
+	if (block_size < SizeClasses::MAX_SIZE) return SizeClasses::floor_class(block_size);
+	return SizeClasses::NUM_CLASSES - 1 + std::bit_width(block_size) - 1 - LARGE_SHIFT;
+}
+
+// For counters with one writer at a time
+template <class T>
+inline void add_relaxed(std::atomic<T>& counter, T n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline Arena* arena_of(const void* block) {
+	return reinterpret_cast<Arena*>(reinterpret_cast<uintptr_t>(block) & ~(ARENA_SIZE - 1));
+}
+
+// Slab slots travel the front end like blocks, as slot - HEADER_SIZE. Returns
+// the slab if block stands for a slot, nullptr if it is a real block.
+inline Slab* slab_of(const char* block) {
+	const char* ptr = block + HEADER_SIZE;
+	Arena* arena = arena_of(block);
+	size_t page = static_cast<size_t>(ptr - reinterpret_cast<char*>(arena)) / SLAB_SIZE;
+	if (page >= SLAB_PAGES || !(arena->slab_pages[page / 64].load(std::memory_order_relaxed) >> (page % 64) & 1)) return nullptr;
+	return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(SLAB_SIZE - 1));
+}
+
+// Back end. Callers hold shard.lock.
+
+// Carves a block of total_size bytes and returns its header, or nullptr. When
+// `grow` is set, a failed search is followed by a full coalesce and then a new
+// arena; otherwise only the free lists are searched.
+char* shard_alloc(Shard& shard, size_t total_size, bool grow);
+
+// Carves n blocks of total_size bytes into out, cutting runs of them from as
+// few free blocks as possible. Returns how many were carved, which is less
+// than n only if the shard could not grow.
+size_t shard_alloc_batch(Shard& shard, size_t total_size, size_t n, char** out);
+
+// Same as shard_alloc(shard, total_size, true), for a block whose payload is
+// aligned to `alignment`, a power of two above ALIGNMENT. Slack cut off in
+// front of the block goes back to the free lists.
+char* shard_alloc_aligned(Shard& shard, size_t total_size, size_t alignment);
+
+// Marks an allocated block free, returns it to the free lists and merges it
+// with its neighbours. With deferred coalescing, a block of a size class is
+// parked instead and merged later.
+void shard_free(Shard& shard, char* block);
+
+// shard_free for n blocks of the shard, none of them slab slots. Blocks that
+// are not parked are all marked free first, then merged in one pass in
+// address order, so adjacent blocks of the batch are merged with each other
+// once. Reorders blocks.
+void shard_free_batch(Shard& shard, char** blocks, int n);
+
+// Resizes an allocated block to total_size bytes without moving it. Returns
+// false, leaving the block as it was, if it cannot grow in place.
+bool shard_resize(Shard& shard, char* block, size_t total_size);
+
+// Takes up to n slots of slab class c into out, as slot - HEADER_SIZE, and
+// returns how many it got. With `grow` a new slab may take a new arena;
+// otherwise slabs are only cut from the free lists.
+size_t slab_alloc(Shard& shard, int c, size_t n, char** out, bool grow);
+
+// Returns a slot (as slot - HEADER_SIZE) to its slab. A slab left empty goes
+// back to the free lists unless it is the last one of its class.
+void slab_free(Shard& shard, char* block);
+
+// Huge blocks. Blocks of at least huge_threshold bytes are mapped on their
+// own, ARENA_SIZE aligned and HUGE_PAGE aligned once they span a huge page,
+// and never touch a shard. Freed mappings are kept in a small cache for the
+// next huge request instead of being unmapped right away. Callers check
+// is_huge_size and call huge_alloc before locking a shard; the shard
+// allocation calls above only take smaller sizes, or aligned ones above
+// ARENA_SIZE.
+constexpr size_t HUGE_PAGE = 2 << 20;
+extern std::atomic<size_t> huge_threshold;
+
+inline bool is_huge_size(size_t total_size) {
+	return total_size >= huge_threshold.load(std::memory_order_relaxed);
+}
+extern std::atomic<size_t> huge_mapped_bytes;  // in use and cached
+extern std::mutex huge_cache_lock;
+
+// A block of total_size bytes whose payload is aligned to `alignment`, at most
+// ARENA_SIZE, or nullptr if mmap fails.
+char* huge_alloc(size_t total_size, size_t alignment);
+void huge_free(char* block);
+
+// Front end. Hands the calling thread's queued frees, and those it keeps for
+// reuse while not pooling, back to their shards.
+void drain_pending();
+
+// A block for memory the program did not ask for directly, such as a region
+// chunk: neither predictor sees it and no pools are topped up. Returns the
+// payload, like allocate().
+void* allocate_unobserved(size_t size);
+
+// Claims a counter slot for the calling thread; never returns nullptr.
+ThreadStats* acquire_thread_stats();
+void release_thread_stats(ThreadStats* stats);
+// Slot for calls made without a thread cache; update it with fetch_add.
+ThreadStats* shared_thread_stats();
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "heap.h"
+#include "heap_internal.h"
+#include "trace.h"
+
+// Freed huge mappings kept for reuse: at most HUGE_CACHE_SLOTS of them and
+// HUGE_CACHE_BYTES in all, oldest first. A cached mapping is only reused for
+// a request that needs more than half of it.
+constexpr int HUGE_CACHE_SLOTS = 8;
+constexpr size_t HUGE_CACHE_BYTES = 64 << 20;
+
+std::atomic<size_t> huge_threshold{ARENA_SIZE / 2};
+std::atomic<size_t> huge_mapped_bytes{0};
+std::mutex huge_cache_lock;
+
+static Arena* cached[HUGE_CACHE_SLOTS];
+static int cached_count = 0;
+static size_t cached_bytes = 0;
+
+static size_t round_up(size_t value, size_t unit) {
+	return (value + unit - 1) / unit * unit;
+}
+
+// Maps size bytes aligned to ARENA_SIZE, or to HUGE_PAGE when the mapping
+// spans one, and asks for transparent huge pages in that case.
+static Arena* map_huge(size_t size) {
+	size_t span = size >= HUGE_PAGE ? HUGE_PAGE : ARENA_SIZE;
+	char* mem = reinterpret_cast<char*>(mmap(nullptr, size + span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (mem == MAP_FAILED) return nullptr;
+	char* base = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(mem), span));
+	if (base != mem) munmap(mem, base - mem);
+	if (base + size != mem + size + span) munmap(base + size, mem + span - base);
+	if (span == HUGE_PAGE) madvise(base, size, MADV_HUGEPAGE);
+
+	Arena* arena = reinterpret_cast<Arena*>(base);
+	arena->size = size;
+	arena->next = nullptr;
+	arena->owner = nullptr;
+	for (std::atomic<uint64_t>& word : arena->slab_pages) word.store(0, std::memory_order_relaxed);
+	huge_mapped_bytes.fetch_add(size, std::memory_order_relaxed);
+	trace::emit(TraceEvent::ArenaMap, size);
+	return arena;
+}
+
+static void unmap_huge(Arena* arena) {
+	huge_mapped_bytes.fetch_sub(arena->size, std::memory_order_relaxed);
+	trace::emit(TraceEvent::ArenaRelease, arena->size);
+	munmap(arena, arena->size);
+}
+
+// The smallest cached mapping of at least size bytes that the request would
+// still fill more than half of
+static Arena* take_cached(size_t size) {
+	std::lock_guard<std::mutex> guard(huge_cache_lock);
+	int best = -1;
+	for (int i = 0; i < cached_count; ++i) {
+		size_t have = cached[i]->size;
+		if (have >= size && have / 2 < size && (best < 0 || have < cached[best]->size)) best = i;
+	}
+	if (best < 0) return nullptr;
+	Arena* arena = cached[best];
+	std::copy(cached + best + 1, cached + cached_count, cached + best);
+	--cached_count;
+	cached_bytes -= arena->size;
+	return arena;
+}
+
+char* huge_alloc(size_t total_size, size_t alignment) {
+	size_t lead = round_up(ARENA_HEADER_SIZE + HEADER_SIZE, alignment);
+	if (total_size > SIZE_MAX / 2 - lead) return nullptr;
+	// Mappings that span a huge page are whole huge pages, so a cached one
+	// fits requests of nearby sizes too
+	size_t size = round_up(lead + total_size, sysconf(_SC_PAGESIZE));
+	if (size >= HUGE_PAGE) size = round_up(size, HUGE_PAGE);
+
+	Arena* arena = take_cached(size);
+	if (arena == nullptr) arena = map_huge(size);
+	if (arena == nullptr) return nullptr;
+
+	// The block runs to the end of the mapping, less the header's 8 bytes of
+	// offset so its size stays a multiple of ALIGNMENT
+	arena->first = lead - HEADER_SIZE;
+	char* block = reinterpret_cast<char*>(arena) + arena->first;
+	*reinterpret_cast<size_t*>(block) = (arena->size - lead) | ALLOCATED | HUGE_BLOCK;
+	return block;
+}
+
+void huge_free(char* block) {
+	Arena* arena = arena_of(block);
+	Arena* evicted = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(huge_cache_lock);
+		if (arena->size <= HUGE_CACHE_BYTES) {
+			// Make room by dropping the oldest mappings
+			while (cached_count > 0 && (cached_count == HUGE_CACHE_SLOTS || cached_bytes + arena->size > HUGE_CACHE_BYTES)) {
+				if (evicted != nullptr) unmap_huge(evicted);
+				evicted = cached[0];
+				std::copy(cached + 1, cached + cached_count, cached);
+				--cached_count;
+				cached_bytes -= evicted->size;
+			}
+			cached[cached_count++] = arena;
+			cached_bytes += arena->size;
+			arena = nullptr;
+		}
+	}
+	if (evicted != nullptr) unmap_huge(evicted);
+	if (arena != nullptr) unmap_huge(arena);
+}
+
+void set_huge_threshold(size_t bytes) {
+	huge_threshold.store(std::max(bytes, SizeClasses::MAX_SIZE + ALIGNMENT), std::memory_order_relaxed);
+}
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "heap.h"
+#include "heap_internal.h"
+
+// Drop-in replacement for the C allocation functions and the C++ operator
+// new/delete family, so the allocator can be loaded with
+//   LD_PRELOAD=build/libmarkov_preload.so <program>
+// Linking this file into a program has the same effect.
+//
+// The heap aligns every block to ALIGNMENT, which covers malloc's
+// alignof(max_align_t); larger alignments go through aligned_allocate. Either
+// way the pointer handed out is the block's payload.
+
+constexpr size_t MALLOC_ALIGNMENT = alignof(max_align_t);
+
+static_assert(ALIGNMENT >= MALLOC_ALIGNMENT, "malloc results must be max_align_t aligned");
+
+static void* aligned_malloc(size_t size, size_t alignment) {
+	if (size == 0) size = 1;
+	return aligned_allocate(size, alignment);
+}
+
+static size_t usable_size(void* ptr) {
+	char* block = static_cast<char*>(ptr) - HEADER_SIZE;
+	if (Slab* slab = slab_of(block)) return slab->slot_size;
+	return block_size_of(block) - HEADER_SIZE;
+}
+
+static void* checked(void* p) {
+	if (p == nullptr) errno = ENOMEM;
+	return p;
+}
+
+// Shard locks are held across fork() so the child never inherits one that
+// another thread held mid-update.
+static void lock_shards() {
+	for (Shard& shard : shards) shard.lock.lock();
+	huge_cache_lock.lock();
+}
+
+static void unlock_shards() {
+	huge_cache_lock.unlock();
+	for (Shard& shard : shards) shard.lock.unlock();
+}
+
+__attribute__((constructor)) static void install_fork_handlers() {
+	pthread_atfork(lock_shards, unlock_shards, unlock_shards);
+}
+
+// Warm start: threads begin from the snapshot named by MARKOV_PROFILE, and the
+// thread that exits the process writes its counts to MARKOV_PROFILE_SAVE.
+__attribute__((constructor)) static void load_profile() {
+	const char* path = getenv("MARKOV_PROFILE");
+	if (path != nullptr && *path != '\0') load_prediction_profile(path);
+}
+
+__attribute__((destructor)) static void save_profile() {
+	const char* path = getenv("MARKOV_PROFILE_SAVE");
+	if (path != nullptr && *path != '\0') save_prediction_profile(path);
+}
+
+extern "C" {
+
+void* malloc(size_t size) {
+	return checked(aligned_malloc(size, MALLOC_ALIGNMENT));
+}
+
+void free(void* ptr) {
+	deallocate(ptr);
+}
+
+void* calloc(size_t n, size_t size) {
+	size_t total;
+	if (__builtin_mul_overflow(n, size, &total)) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	void* p = checked(aligned_malloc(total, MALLOC_ALIGNMENT));
+	if (p != nullptr) std::memset(p, 0, total);
+	return p;
+}
+
+void* realloc(void* ptr, size_t size) {
+	if (ptr == nullptr) return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return nullptr;
+	}
+
+	return checked(reallocate(ptr, size));
+}
+
+void* reallocarray(void* ptr, size_t n, size_t size) {
+	size_t total;
+	if (__builtin_mul_overflow(n, size, &total)) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+	return realloc(ptr, total);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+	if (alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+	void* p = aligned_malloc(size, std::max(alignment, MALLOC_ALIGNMENT));
+	if (p == nullptr) return ENOMEM;
+	*out = p;
+	return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return nullptr;
+	}
+	return checked(aligned_malloc(size, std::max(alignment, MALLOC_ALIGNMENT)));
+}
+
+void* memalign(size_t alignment, size_t size) {
+	return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size) {
+	return checked(aligned_malloc(size, sysconf(_SC_PAGESIZE)));
+}
+
+void* pvalloc(size_t size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return checked(aligned_malloc((size + page - 1) & ~(page - 1), page));
+}
+
+size_t malloc_usable_size(void* ptr) {
+	return ptr == nullptr ? 0 : usable_size(ptr);
+}
+
+}  // extern "C"
+
+// operator new retries through the installed new_handler, as the standard
+// requires, and throws once there is none.
+static void* new_impl(size_t size, size_t alignment) {
+	for (;;) {
+		void* p = aligned_malloc(size, alignment);
+		if (p != nullptr) return p;
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr) throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void* new_nothrow(size_t size, size_t alignment) noexcept {
+	try {
+		return new_impl(size, alignment);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+static size_t new_alignment(std::align_val_t alignment) {
+	return std::max(static_cast<size_t>(alignment), size_t(__STDCPP_DEFAULT_NEW_ALIGNMENT__));
+}
+
+void* operator new(size_t size) { return new_impl(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size) { return new_impl(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return new_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return new_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t al) { return new_impl(size, new_alignment(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return new_impl(size, new_alignment(al)); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return new_nothrow(size, new_alignment(al)); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return new_nothrow(size, new_alignment(al)); }
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { deallocate_sized(ptr, size); }
+void operator delete[](void* ptr, size_t size) noexcept { deallocate_sized(ptr, size); }
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size, std::align_val_t) noexcept { deallocate_sized(ptr, size); }
+void operator delete[](void* ptr, size_t size, std::align_val_t) noexcept { deallocate_sized(ptr, size); }
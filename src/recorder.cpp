@@ -0,0 +1,242 @@
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "recorder.h"
+
+// Buffers and per-thread slots come from mmap and static storage rather than
+// the heap, so recording never allocates through the allocator it records.
+
+constexpr size_t RECORD_BUFFER = 2048;  // records per buffer, 64 KB
+constexpr int MAX_SLOTS = 1024;         // threads recording at once
+
+struct RecordBuffer {
+    uint32_t count;
+    RecordBuffer* next;  // link on the free or full list
+    AllocRecord records[RECORD_BUFFER];
+};
+
+// A thread's current buffer. busy is held by the owning thread while it
+// appends and by record_stop while it flushes.
+struct RecordSlot {
+    std::atomic_flag busy = ATOMIC_FLAG_INIT;
+    RecordBuffer* buf = nullptr;
+    bool in_use = false;
+};
+
+std::atomic<bool> record_enabled{false};
+
+static RecordSlot slots[MAX_SLOTS];
+static std::mutex slots_lock;
+static std::atomic<uint16_t> next_thread{0};
+
+// Writer state, all under queue_lock
+static std::mutex queue_lock;
+static std::condition_variable queue_ready;
+static RecordBuffer* free_buffers = nullptr;
+static RecordBuffer* full_head = nullptr;
+static RecordBuffer* full_tail = nullptr;
+static bool writer_stopping = false;
+
+static std::mutex session_lock;  // serializes record_start/record_stop
+static std::thread writer;
+static int record_fd = -1;
+
+static RecordBuffer* acquire_buffer() {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    RecordBuffer* buf = free_buffers;
+    if (buf != nullptr) {
+        free_buffers = buf->next;
+    } else {
+        void* mem = mmap(nullptr, sizeof(RecordBuffer), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return nullptr;
+        buf = static_cast<RecordBuffer*>(mem);
+    }
+    buf->count = 0;
+    buf->next = nullptr;
+    return buf;
+}
+
+static void release_buffer(RecordBuffer* buf) {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    buf->next = free_buffers;
+    free_buffers = buf;
+}
+
+// Queues a buffer for the writer thread
+static void submit(RecordBuffer* buf) {
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        buf->next = nullptr;
+        if (full_tail != nullptr) {
+            full_tail->next = buf;
+        } else {
+            full_head = buf;
+        }
+        full_tail = buf;
+    }
+    queue_ready.notify_one();
+}
+
+static void write_all(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t written = write(fd, p, n);
+        if (written <= 0) return;
+        p += written;
+        n -= written;
+    }
+}
+
+static void writer_loop(int fd) {
+    std::unique_lock<std::mutex> guard(queue_lock);
+    for (;;) {
+        queue_ready.wait(guard, [] { return full_head != nullptr || writer_stopping; });
+        if (full_head == nullptr) return;
+
+        RecordBuffer* buf = full_head;
+        full_head = buf->next;
+        if (full_head == nullptr) full_tail = nullptr;
+
+        guard.unlock();
+        write_all(fd, buf->records, buf->count * sizeof(AllocRecord));
+        guard.lock();
+
+        buf->next = free_buffers;
+        free_buffers = buf;
+    }
+}
+
+// Claims a slot on a thread's first record and releases it at thread exit
+struct SlotOwner {
+    RecordSlot* slot = nullptr;
+    uint16_t thread = 0;
+
+    RecordSlot* get() {
+        if (slot != nullptr) return slot;
+        std::lock_guard<std::mutex> guard(slots_lock);
+        for (RecordSlot& s : slots) {
+            if (!s.in_use) {
+                s.in_use = true;
+                slot = &s;
+                thread = next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+                break;
+            }
+        }
+        return slot;
+    }
+
+    ~SlotOwner() {
+        if (slot == nullptr) return;
+        while (slot->busy.test_and_set(std::memory_order_acquire)) {}
+        if (slot->buf != nullptr) {
+            if (record_enabled.load(std::memory_order_relaxed) && slot->buf->count > 0) {
+                submit(slot->buf);
+            } else {
+                release_buffer(slot->buf);
+            }
+            slot->buf = nullptr;
+        }
+        slot->busy.clear(std::memory_order_release);
+
+        std::lock_guard<std::mutex> guard(slots_lock);
+        slot->in_use = false;
+    }
+};
+
+static thread_local SlotOwner owner;
+static thread_local bool inside = false;
+
+void record_event(RecordOp op, size_t size, const void* ptr, uint32_t ctx, uint8_t align_shift) {
+    // Setting up the thread's slot may itself allocate
+    if (inside) return;
+    inside = true;
+
+    RecordSlot* slot = owner.get();
+    if (slot != nullptr) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (slot->busy.test_and_set(std::memory_order_acquire)) {}
+        if (slot->buf == nullptr) slot->buf = acquire_buffer();
+        RecordBuffer* buf = slot->buf;
+        if (buf != nullptr) {
+            buf->records[buf->count++] = {static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec,
+                                          reinterpret_cast<uint64_t>(ptr), size, ctx, owner.thread, op, align_shift};
+            if (buf->count == RECORD_BUFFER) {
+                submit(buf);
+                slot->buf = acquire_buffer();
+            }
+        }
+        slot->busy.clear(std::memory_order_release);
+    }
+
+    inside = false;
+}
+
+bool record_start(const char* path) {
+    std::lock_guard<std::mutex> session(session_lock);
+    if (record_enabled.load()) return false;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    RecordFileHeader header;
+    std::memcpy(header.magic, RECORD_MAGIC, sizeof header.magic);
+    header.version = RECORD_VERSION;
+    header.record_size = sizeof(AllocRecord);
+    write_all(fd, &header, sizeof header);
+
+    // Drop anything left over from a previous session
+    for (RecordSlot& slot : slots) {
+        while (slot.busy.test_and_set(std::memory_order_acquire)) {}
+        if (slot.buf != nullptr) slot.buf->count = 0;
+        slot.busy.clear(std::memory_order_release);
+    }
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        while (full_head != nullptr) {
+            RecordBuffer* buf = full_head;
+            full_head = buf->next;
+            buf->next = free_buffers;
+            free_buffers = buf;
+        }
+        full_tail = nullptr;
+        writer_stopping = false;
+    }
+
+    record_fd = fd;
+    writer = std::thread(writer_loop, fd);
+    record_enabled.store(true);
+    return true;
+}
+
+void record_stop() {
+    std::lock_guard<std::mutex> session(session_lock);
+    if (!record_enabled.load()) return;
+    record_enabled.store(false);
+
+    // Hand every partly filled buffer to the writer
+    for (RecordSlot& slot : slots) {
+        while (slot.busy.test_and_set(std::memory_order_acquire)) {}
+        if (slot.buf != nullptr && slot.buf->count > 0) {
+            submit(slot.buf);
+            slot.buf = nullptr;
+        }
+        slot.busy.clear(std::memory_order_release);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        writer_stopping = true;
+    }
+    queue_ready.notify_one();
+    writer.join();
+
+    close(record_fd);
+    record_fd = -1;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <new>
+#include "heap.h"
+#include "heap_internal.h"
+#include "region.h"
+
+// A chunk is one heap block: this header, then the bump space. used is the
+// offset of the first free byte and may run past size once the chunk is full.
+struct Region::Chunk {
+	Chunk* next;
+	size_t size;
+	std::atomic<size_t> used;
+};
+
+const size_t Region::CHUNK_HEADER = align(sizeof(Chunk));
+
+Region::Region(size_t chunk_size) : chunk_size(std::max(chunk_size, size_t(1024))) {}
+
+Region::~Region() {
+	for (Chunk* chunk = chunks; chunk != nullptr;) {
+		Chunk* next = chunk->next;
+		deallocate(chunk);
+		chunk = next;
+	}
+}
+
+// Carves n bytes from a chunk, or returns nullptr if it is full. Chunks are
+// ALIGNMENT aligned, so smaller alignments only need the size rounded up and
+// a single fetch_add; larger ones go through a compare-and-swap.
+void* Region::bump(Chunk* chunk, size_t n, size_t alignment) {
+	char* base = reinterpret_cast<char*>(chunk);
+	if (alignment <= ALIGNMENT) {
+		size_t size = align(n);
+		size_t offset = chunk->used.fetch_add(size, std::memory_order_relaxed);
+		return offset + size <= chunk->size ? base + offset : nullptr;
+	}
+
+	size_t offset = chunk->used.load(std::memory_order_relaxed);
+	for (;;) {
+		uintptr_t start = (reinterpret_cast<uintptr_t>(base) + offset + alignment - 1) & ~(alignment - 1);
+		size_t end = start - reinterpret_cast<uintptr_t>(base) + n;
+		if (end > chunk->size) return nullptr;
+		if (chunk->used.compare_exchange_weak(offset, end, std::memory_order_relaxed)) return reinterpret_cast<char*>(start);
+	}
+}
+
+// Chunks come from the heap like a moved reallocation: not something the
+// program asked for, so the predictors never see them.
+Region::Chunk* Region::take_chunk(size_t size) {
+	void* mem = allocate_unobserved(size);
+	if (mem == nullptr) return nullptr;
+	Chunk* chunk = new (mem) Chunk{chunks, size, {CHUNK_HEADER}};
+	chunks = chunk;
+	bytes.fetch_add(size, std::memory_order_relaxed);
+	return chunk;
+}
+
+void* Region::allocate(size_t n, size_t alignment) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) return nullptr;
+	if (n > SIZE_MAX / 4 || alignment > SIZE_MAX / 4) return nullptr;
+	if (n == 0) n = 1;
+
+	// Large requests get a chunk of their own and leave the current one alone
+	size_t needed = CHUNK_HEADER + align(n) + (alignment > ALIGNMENT ? alignment : 0);
+	if (needed > chunk_size / 4) {
+		std::lock_guard<std::mutex> guard(refill_lock);
+		Chunk* own = take_chunk(needed);
+		return own != nullptr ? bump(own, n, alignment) : nullptr;
+	}
+
+	Chunk* chunk = current.load(std::memory_order_acquire);
+	if (chunk != nullptr) {
+		void* p = bump(chunk, n, alignment);
+		if (p != nullptr) [[likely]] return p;
+	}
+	return refill(n, alignment);
+}
+
+void* Region::refill(size_t n, size_t alignment) {
+	std::lock_guard<std::mutex> guard(refill_lock);
+
+	// Another thread may have put in a new chunk while this one waited
+	Chunk* chunk = current.load(std::memory_order_relaxed);
+	if (chunk != nullptr) {
+		void* p = bump(chunk, n, alignment);
+		if (p != nullptr) return p;
+	}
+
+	Chunk* fresh = take_chunk(chunk_size);
+	if (fresh == nullptr) return nullptr;
+	void* p = bump(fresh, n, alignment);
+	current.store(fresh, std::memory_order_release);
+	return p;
+}
+
+void Region::reset() {
+	std::lock_guard<std::mutex> guard(refill_lock);
+	Chunk* keep = current.load(std::memory_order_relaxed);
+	for (Chunk* chunk = chunks; chunk != nullptr;) {
+		Chunk* next = chunk->next;
+		if (chunk != keep) {
+			bytes.fetch_sub(chunk->size, std::memory_order_relaxed);
+			deallocate(chunk);
+		}
+		chunk = next;
+	}
+
+	chunks = keep;
+	if (keep != nullptr) {
+		keep->next = nullptr;
+		keep->used.store(CHUNK_HEADER, std::memory_order_relaxed);
+	}
+}
+
+void* RegionResource::do_allocate(size_t bytes, size_t alignment) {
+	void* p = region.allocate(bytes, alignment);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
@@ -0,0 +1,37 @@
+#include <new>
+#include "heap.h"
+#include "heap_internal.h"
+#include "resource.h"
+
+MarkovMemoryResource::MarkovMemoryResource(bool own_predictor) {
+	if (!own_predictor) return;
+	own = create_prediction_model();
+	if (own == nullptr) throw std::bad_alloc();
+}
+
+MarkovMemoryResource::~MarkovMemoryResource() {
+	destroy_prediction_model(own);
+}
+
+// pmr callers may ask for 0 bytes and still expect a distinct pointer
+void* MarkovMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+	if (bytes == 0) bytes = 1;
+	void* p;
+	if (alignment > ALIGNMENT) {
+		p = ::aligned_allocate(bytes, alignment);
+	} else if (own != nullptr) {
+		p = ::allocate(bytes, *own);
+	} else {
+		p = ::allocate(bytes);
+	}
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void MarkovMemoryResource::do_deallocate(void* p, size_t bytes, size_t) {
+	deallocate_sized(p, bytes == 0 ? 1 : bytes);
+}
+
+bool MarkovMemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+	return dynamic_cast<const MarkovMemoryResource*>(&other) != nullptr;
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <sys/mman.h>
+#include "heap.h"
+#include "heap_internal.h"
+
+static_assert(STATS_CLASSES == SizeClasses::NUM_CLASSES + 1, "heap.h and the heap must use the same size classes");
+
+// Every slot ever handed out, newest first. Slots are only ever pushed, so
+// readers can walk the list without a lock.
+static std::atomic<ThreadStats*> all_stats{nullptr};
+
+// Shared by threads that could not get a slot of their own and by calls made
+// without a thread cache. Threads that fell back here use the single-writer
+// increments, so a few of their updates may be lost.
+static ThreadStats overflow_stats;
+
+ThreadStats* shared_thread_stats() {
+	return &overflow_stats;
+}
+
+ThreadStats* acquire_thread_stats() {
+	for (ThreadStats* s = all_stats.load(std::memory_order_acquire); s != nullptr; s = s->next) {
+		bool expected = false;
+		if (s->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) return s;
+	}
+
+	// Mapped directly: the heap may not be usable yet when a thread starts
+	void* mem = mmap(nullptr, sizeof(ThreadStats), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return &overflow_stats;
+	ThreadStats* stats = new (mem) ThreadStats{};
+	stats->in_use.store(true, std::memory_order_relaxed);
+
+	ThreadStats* head = all_stats.load(std::memory_order_relaxed);
+	do {
+		stats->next = head;
+	} while (!all_stats.compare_exchange_weak(head, stats, std::memory_order_release, std::memory_order_relaxed));
+	return stats;
+}
+
+void release_thread_stats(ThreadStats* stats) {
+	if (stats == &overflow_stats) return;
+	stats->pooled_bytes.store(0, std::memory_order_relaxed);
+	stats->in_use.store(false, std::memory_order_release);
+}
+
+HeapStats get_heap_stats() {
+	HeapStats out{};
+	uint64_t allocated_bytes = 0;
+	uint64_t freed_bytes = 0;
+
+	auto add_thread = [&](const ThreadStats& s) {
+		for (int c = 0; c < STATS_CLASSES; ++c) {
+			out.cache_hits[c] += s.hits[c].load(std::memory_order_relaxed);
+			out.cache_misses[c] += s.misses[c].load(std::memory_order_relaxed);
+		}
+		out.frees += s.frees.load(std::memory_order_relaxed);
+		out.predictions += s.predictions.load(std::memory_order_relaxed);
+		out.prediction_hits += s.prediction_hits.load(std::memory_order_relaxed);
+		out.pooled_bytes += s.pooled_bytes.load(std::memory_order_relaxed);
+		allocated_bytes += s.allocated_bytes.load(std::memory_order_relaxed);
+		freed_bytes += s.freed_bytes.load(std::memory_order_relaxed);
+	};
+	for (ThreadStats* s = all_stats.load(std::memory_order_acquire); s != nullptr; s = s->next) add_thread(*s);
+	add_thread(overflow_stats);
+
+	for (int c = 0; c < STATS_CLASSES; ++c) out.allocations += out.cache_hits[c] + out.cache_misses[c];
+	// Counters are read one at a time, so a free may be seen before its allocation
+	out.bytes_in_use = allocated_bytes > freed_bytes ? allocated_bytes - freed_bytes : 0;
+
+	for (Shard& shard : shards) {
+		out.free_bytes += shard.free_bytes.load(std::memory_order_relaxed);
+		out.free_fragments += shard.free_blocks.load(std::memory_order_relaxed);
+		out.largest_free_block = std::max(out.largest_free_block, shard.largest_free.load(std::memory_order_relaxed));
+		out.mapped_bytes += shard.mapped_bytes.load(std::memory_order_relaxed);
+		out.coalesces += shard.coalesces.load(std::memory_order_relaxed);
+		out.parked_bytes += shard.parked_bytes.load(std::memory_order_relaxed);
+	}
+	out.mapped_bytes += huge_mapped_bytes.load(std::memory_order_relaxed);
+	return out;
+}
+
+size_t heap_stats_json(char* buf, size_t size) {
+	HeapStats s = get_heap_stats();
+	size_t len = 0;
+
+	// Appends like snprintf, but keeps counting once the buffer is full
+	auto put = [&](const char* fmt, auto... args) {
+		char* dst = len < size ? buf + len : nullptr;
+		int n = std::snprintf(dst, dst != nullptr ? size - len : 0, fmt, args...);
+		if (n > 0) len += n;
+	};
+	auto u = [](uint64_t v) { return static_cast<unsigned long long>(v); };
+
+	put("{\"allocations\":%llu,\"frees\":%llu,", u(s.allocations), u(s.frees));
+	put("\"predictions\":%llu,\"prediction_hits\":%llu,", u(s.predictions), u(s.prediction_hits));
+	put("\"bytes_in_use\":%llu,\"pooled_bytes\":%llu,", u(s.bytes_in_use), u(s.pooled_bytes));
+	put("\"free_bytes\":%llu,\"largest_free_block\":%llu,", u(s.free_bytes), u(s.largest_free_block));
+	put("\"free_fragments\":%llu,\"coalesces\":%llu,", u(s.free_fragments), u(s.coalesces));
+	put("\"mapped_bytes\":%llu,\"parked_bytes\":%llu,\"classes\":[", u(s.mapped_bytes), u(s.parked_bytes));
+
+	// Only classes that have seen traffic; size 0 stands for "larger than every class"
+	bool first = true;
+	for (int c = 0; c < STATS_CLASSES; ++c) {
+		if (s.cache_hits[c] == 0 && s.cache_misses[c] == 0) continue;
+		size_t class_size = c < SizeClasses::NUM_CLASSES ? SizeClasses::class_size(c) : 0;
+		put("%s{\"size\":%llu,\"hits\":%llu,\"misses\":%llu}", first ? "" : ",", u(class_size), u(s.cache_hits[c]),
+		    u(s.cache_misses[c]));
+		first = false;
+	}
+	put("]}");
+
+	return len;
+}
@@ -0,0 +1,71 @@
+#include <atomic>
+#include "trace.h"
+
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+// A slot's seq holds 1 + its record's position once the record is complete,
+// and 0 while a writer is filling it in.
+struct TraceSlot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> tag{0};  // event | thread << 8
+    std::atomic<uint64_t> a{0};
+    std::atomic<uint64_t> b{0};
+};
+
+static TraceSlot ring[TRACE_CAPACITY];
+static std::atomic<uint64_t> head{0};
+static std::atomic<uint32_t> next_thread{0};
+
+static uint32_t thread_id() {
+    static thread_local uint32_t id = next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+    return id;
+}
+
+void Tracer<true>::emit(TraceEvent event, uint64_t a, uint64_t b) {
+    uint64_t pos = head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& slot = ring[pos & (TRACE_CAPACITY - 1)];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.tag.store(static_cast<uint64_t>(event) | static_cast<uint64_t>(thread_id()) << 8, std::memory_order_relaxed);
+    slot.a.store(a, std::memory_order_relaxed);
+    slot.b.store(b, std::memory_order_relaxed);
+    slot.seq.store(pos + 1, std::memory_order_release);
+}
+
+size_t trace_snapshot(TraceRecord* out, size_t n) {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+    if (end - begin > n) begin = end - n;
+
+    size_t count = 0;
+    for (uint64_t pos = begin; pos < end; ++pos) {
+        TraceSlot& slot = ring[pos & (TRACE_CAPACITY - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != pos + 1) continue;
+
+        uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        TraceRecord record{pos, static_cast<TraceEvent>(tag & 0xff), static_cast<uint32_t>(tag >> 8),
+                           slot.a.load(std::memory_order_relaxed), slot.b.load(std::memory_order_relaxed)};
+
+        // Discard the copy if a writer reused the slot while we read it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != pos + 1) continue;
+        out[count++] = record;
+    }
+    return count;
+}
+
+const char* trace_event_name(TraceEvent event) {
+    switch (event) {
+    case TraceEvent::CacheHit: return "cache_hit";
+    case TraceEvent::CacheMiss: return "cache_miss";
+    case TraceEvent::Predict: return "predict";
+    case TraceEvent::PoolPush: return "pool_push";
+    case TraceEvent::PoolRefill: return "pool_refill";
+    case TraceEvent::Drain: return "drain";
+    case TraceEvent::Coalesce: return "coalesce";
+    case TraceEvent::ArenaMap: return "arena_map";
+    case TraceEvent::ArenaRelease: return "arena_release";
+    }
+    return "unknown";
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+uint64_t total_hits(const HeapStats& s) {
+    uint64_t hits = 0;
+    for (int c = 0; c < STATS_CLASSES; ++c) hits += s.cache_hits[c];
+    return hits;
+}
+
+// Trains 100 bytes to be followed by 200 or 300 bytes equally often, then
+// frees a 200 byte block right after a 100 byte allocation; returns whether
+// the pools kept it.
+bool pools_even_odds(float threshold) {
+    set_prediction_threshold(threshold);
+    for (int round = 0; round < 1000; ++round) {
+        void* a = allocate(100);
+        void* b = allocate(round % 2 ? 200 : 300);
+        deallocate(b);
+        deallocate(a);
+    }
+    void* spare = allocate(200);
+    void* a = allocate(100);
+    size_t pooled = get_heap_stats().pooled_bytes;
+    deallocate(spare);
+    bool kept = get_heap_stats().pooled_bytes > pooled;
+    deallocate(a);
+    return kept;
+}
+
+// Allocates and frees the sizes in order, rounds times over
+void repeat(const std::vector<size_t>& sizes, int rounds) {
+    std::vector<void*> live(sizes.size());
+    for (int round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < sizes.size(); ++i) live[i] = allocate(sizes[i]);
+        for (void* p : live) deallocate(p);
+    }
+}
+
+int main() {
+    std::cout << "=== Adaptive Caching Test ===\n";
+    bool ok = true;
+
+    ok &= check(pools_even_odds(0.25f), "a class that comes next half the time is pooled by default");
+    ok &= check(!pools_even_odds(0.6f), "a stricter threshold leaves it out");
+    set_prediction_threshold(0.25f);
+
+    // After a long first phase, the predictor follows a new order of the same
+    // sizes within a few dozen rounds
+    repeat({100, 200, 300}, 30000);
+    repeat({100, 300, 200}, 200);
+    HeapStats before = get_heap_stats();
+    repeat({100, 300, 200}, 1000);
+    HeapStats after = get_heap_stats();
+    double accuracy = double(after.prediction_hits - before.prediction_hits) / (after.predictions - before.predictions);
+    std::cout << "  " << accuracy * 100 << "% predicted after the phase change\n";
+    ok &= check(accuracy > 0.9, "old counts decay");
+
+    // Random sizes: the pools stop paying, so the thread stops pooling
+    std::mt19937 rng(5);
+    std::vector<void*> live(64, nullptr);
+    auto churn = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            void*& slot = live[rng() % live.size()];
+            deallocate(slot);
+            slot = allocate(1 + rng() % 4000);
+        }
+    };
+    churn(20000);
+    before = get_heap_stats();
+    churn(10000);
+    after = get_heap_stats();
+    std::cout << "  " << total_hits(after) - total_hits(before) << " pool hits in 10000 random allocations\n";
+    ok &= check(total_hits(after) == total_hits(before), "random sizes turn pooling off");
+    ok &= check(after.pooled_bytes == 0, "pooled blocks are handed back");
+
+    // Without pooling, a thread's own frees of a class still serve its next
+    // allocations of that class, without going through a shard
+    coalesce_clean();
+    std::vector<void*> same(16);
+    for (void*& p : same) p = allocate(200);
+    before = get_heap_stats();
+    for (void* p : same) deallocate(p);
+    after = get_heap_stats();
+    std::vector<void*> again(same.size());
+    for (void*& p : again) p = allocate(200);
+    ok &= check(after.free_bytes == before.free_bytes && std::is_permutation(same.begin(), same.end(), again.begin()),
+                "frees are reused without pooling");
+    for (void* p : again) deallocate(p);
+
+    // Without adaptation or a threshold, the thread pools whatever comes next
+    set_adaptive_caching(false);
+    set_prediction_threshold(0);
+    before = get_heap_stats();
+    churn(10000);
+    after = get_heap_stats();
+    ok &= check(total_hits(after) > total_hits(before), "turning adaptation off pools again at once");
+    set_adaptive_caching(true);
+    set_prediction_threshold(0.25f);
+    churn(20000);
+    for (void*& p : live) {
+        deallocate(p);
+        p = nullptr;
+    }
+
+    // Repeated huge requests predict nothing, so they leave pooling off. The
+    // probe is too short to turn it on by itself.
+    for (int i = 0; i < 3 * 4096; ++i) deallocate(allocate(1 << 20));
+    before = get_heap_stats();
+    repeat({40, 200, 72, 1000}, 250);
+    after = get_heap_stats();
+    ok &= check(total_hits(after) == total_hits(before), "repeated huge requests do not turn pooling back on");
+
+    // A pattern the predictor gets right turns it back on
+    repeat({40, 200, 72, 1000}, 5000);
+    before = get_heap_stats();
+    repeat({40, 200, 72, 1000}, 1000);
+    after = get_heap_stats();
+    ok &= check(total_hits(after) - total_hits(before) > 3600, "a predictable pattern turns pooling back on");
+
+    return finish(ok);
+}
@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+bool aligned(const void* p, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+int main() {
+    std::cout << "=== Aligned Test ===\n";
+    bool ok = true;
+    HeapStats start = get_heap_stats();
+
+    bool all_aligned = true;
+    std::vector<void*> plain;
+    for (size_t size = 1; size < 3000; size += 13) {
+        void* p = allocate(size);
+        all_aligned &= p != nullptr && aligned(p, 16);
+        plain.push_back(p);
+    }
+    for (void* p : plain) deallocate(p);
+    ok &= check(all_aligned, "allocate returns 16-byte aligned blocks");
+
+    // Every alignment and a spread of sizes, filled to catch overlaps
+    struct Block {
+        unsigned char* p;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    all_aligned = true;
+    for (size_t alignment = 32; alignment <= 8192; alignment *= 2) {
+        for (size_t size : {1, 24, 100, 1000, 5000}) {
+            unsigned char* p = static_cast<unsigned char*>(aligned_allocate(size, alignment));
+            all_aligned &= p != nullptr && aligned(p, alignment);
+            if (p == nullptr) continue;
+            std::memset(p, static_cast<int>(blocks.size()), size);
+            blocks.push_back({p, size});
+        }
+    }
+    bool intact = true;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        intact &= blocks[i].p[0] == static_cast<unsigned char>(i) && blocks[i].p[blocks[i].size - 1] == static_cast<unsigned char>(i);
+    }
+    ok &= check(all_aligned, "aligned_allocate honours alignments from 32 to 8192");
+    ok &= check(intact, "aligned blocks do not overlap");
+
+    HeapStats before = get_heap_stats();
+    void* page = aligned_allocate(64, 4096);
+    HeapStats after = get_heap_stats();
+    ok &= check(aligned(page, 4096) && after.bytes_in_use - before.bytes_in_use < 4096,
+                "the slack in front of an aligned block is not handed out");
+
+    void* big = aligned_allocate(3 << 20, 64);
+    void* huge_alignment = aligned_allocate(100, 2 << 20);
+    ok &= check(big != nullptr && aligned(big, 64), "large aligned blocks get an arena of their own");
+    ok &= check(huge_alignment != nullptr && aligned(huge_alignment, 2 << 20), "alignments above the arena size");
+    if (big != nullptr) std::memset(big, 1, 3 << 20);
+    if (huge_alignment != nullptr) std::memset(huge_alignment, 1, 100);
+
+    ok &= check(aligned_allocate(100, 48) == nullptr && aligned_allocate(100, 0) == nullptr,
+                "alignments that are not a power of two are rejected");
+    void* small = aligned_allocate(100, 8);
+    ok &= check(small != nullptr && aligned(small, 16), "small alignments fall back to allocate");
+
+    for (Block& b : blocks) deallocate(b.p);
+    deallocate(page);
+    deallocate(big);
+    deallocate(huge_alignment);
+    deallocate(small);
+    coalesce_clean();
+    ok &= check(get_heap_stats().bytes_in_use == start.bytes_in_use, "aligned blocks free like any other");
+
+    return finish(ok);
+}
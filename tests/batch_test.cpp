@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+constexpr size_t BATCH = 500;
+
+int main() {
+    std::cout << "=== Batch Test ===\n";
+    bool ok = true;
+    void* first[1];
+    allocate_batch(48, 1, first);  // so the next batch is a transition
+
+    std::vector<void*> blocks(BATCH);
+    HeapStats before = get_heap_stats();
+    size_t got = allocate_batch(48, BATCH, blocks.data());
+    HeapStats after = get_heap_stats();
+    ok &= check(got == BATCH, "allocate_batch fills the whole batch");
+    ok &= check(after.allocations - before.allocations == BATCH, "every block counts as an allocation");
+    ok &= check(after.predictions - before.predictions == 1, "the batch is one transition for the predictor");
+
+    for (size_t i = 0; i < BATCH; ++i) std::memset(blocks[i], static_cast<int>(i), 48);
+    bool intact = true;
+    for (size_t i = 0; i < BATCH; ++i) {
+        const unsigned char* p = static_cast<const unsigned char*>(blocks[i]);
+        intact &= p[0] == static_cast<unsigned char>(i) && p[47] == static_cast<unsigned char>(i);
+    }
+    ok &= check(intact, "blocks do not overlap");
+
+    // Carved in runs, so most blocks sit right after the previous one
+    std::vector<char*> sorted(BATCH);
+    for (size_t i = 0; i < BATCH; ++i) sorted[i] = static_cast<char*>(blocks[i]);
+    std::sort(sorted.begin(), sorted.end());
+    size_t adjacent = 0;
+    for (size_t i = 1; i < BATCH; ++i) adjacent += sorted[i] - sorted[i - 1] == sorted[1] - sorted[0];
+    ok &= check(adjacent >= BATCH * 9 / 10, "blocks are carved in contiguous runs");
+
+    before = get_heap_stats();
+    blocks.push_back(nullptr);
+    deallocate_batch(blocks.data(), blocks.size());
+    after = get_heap_stats();
+    ok &= check(after.frees - before.frees == BATCH, "deallocate_batch frees every block and skips nulls");
+    ok &= check(before.bytes_in_use - after.bytes_in_use >= BATCH * 48, "freed bytes leave bytes in use");
+
+    // A freed batch of neighbouring blocks is merged back into one free block
+    std::vector<void*> run(BATCH);
+    allocate_batch(200, BATCH, run.data());
+    char* low = static_cast<char*>(*std::min_element(run.begin(), run.end()));
+    char* high = static_cast<char*>(*std::max_element(run.begin(), run.end()));
+    deallocate_batch(run.data(), BATCH);
+    ok &= check(get_heap_stats().largest_free_block >= size_t(high - low), "a freed batch is coalesced");
+    deallocate_batch(first, 1);
+
+    // Sized frees of mixed sizes
+    before = get_heap_stats();
+    std::vector<std::pair<void*, size_t>> sized;
+    for (size_t size = 1; size < 3000; size += 37) sized.emplace_back(allocate(size), size);
+    for (auto [p, size] : sized) deallocate_sized(p, size);
+    after = get_heap_stats();
+    ok &= check(after.frees - before.frees == sized.size() && after.bytes_in_use == before.bytes_in_use,
+                "deallocate_sized frees like deallocate");
+
+    // Batches allocated on one thread and freed on another
+    std::vector<void*> handoff(BATCH);
+    for (int round = 0; round < 20; ++round) {
+        std::thread([&] { allocate_batch(200, BATCH, handoff.data()); }).join();
+        std::thread([&] { deallocate_batch(handoff.data(), BATCH); }).join();
+    }
+    coalesce_clean();
+    ok &= check(get_heap_stats().bytes_in_use == before.bytes_in_use, "cross-thread batches balance out");
+
+    return finish(ok);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <iostream>
+
+// Prints one line per check so a failing run shows which one broke
+inline bool check(bool ok, const char* what) {
+    std::cout << (ok ? "  ok: " : "  FAILED: ") << what << "\n";
+    return ok;
+}
+
+// Prints the verdict `make test` reports and returns the exit status
+inline int finish(bool ok) {
+    if (!ok) {
+        std::cout << "Test FAILED\n";
+        return 1;
+    }
+    std::cout << "Test completed successfully\n";
+    return 0;
+}
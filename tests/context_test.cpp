@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include "heap.h"
+
+// Interleaves two streams, 16 -> 64 and 16 -> 256: after a 16-byte request a
+// first-order predictor can only guess, while the last two classes (or the
+// call-site tag) say which stream comes next.
+constexpr size_t PATTERN[] = {16, 64, 16, 256};
+constexpr int ROUNDS = 2000;
+
+struct Accuracy {
+    uint64_t predictions = 0;
+    uint64_t hits = 0;
+
+    double rate() const { return predictions ? 100.0 * hits / predictions : 0.0; }
+};
+
+// Splits the calling thread's contexts into first-order rows and the rest
+void measure(Accuracy& first_order, Accuracy& contextual) {
+    ContextHitRate rates[512];
+    size_t n = context_hit_rates(rates, 512);
+    first_order = {};
+    contextual = {};
+    for (size_t i = 0; i < n; ++i) {
+        Accuracy& a = rates[i].context < 256 ? first_order : contextual;
+        a.predictions += rates[i].predictions;
+        a.hits += rates[i].hits;
+    }
+}
+
+void run(bool tagged) {
+    std::vector<void*> live;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            // Each stream's call sites get their own tag
+            uint32_t ctx = tagged ? 1 + (i >> 1) : 0;
+            live.push_back(allocate(PATTERN[i], ctx));
+        }
+        for (void* p : live) deallocate(p);
+        live.clear();
+    }
+}
+
+int main() {
+    std::cout << "=== Context Predictor Test ===\n";
+    Accuracy first_order, contextual;
+
+    set_predictor_order(2);
+    run(false);
+    measure(first_order, contextual);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "First-order hit rate: " << first_order.rate() << "%\n";
+    std::cout << "Order-2 hit rate:     " << contextual.rate() << "%\n";
+    if (contextual.rate() < 90.0 || first_order.rate() > 90.0) {
+        std::cout << "FAILED: the two-class history should predict the interleaved streams\n";
+        return 1;
+    }
+
+    // Call-site tags split the streams even with a one-class history. A new
+    // thread starts with empty tables, so only tagged contexts are measured.
+    set_predictor_order(1);
+    std::thread([&] {
+        run(true);
+        measure(first_order, contextual);
+
+        ContextHitRate top[4];
+        size_t n = context_hit_rates(top, 4);
+        std::cout << "\nBusiest contexts:\n";
+        for (size_t i = 0; i < n; ++i) {
+            std::cout << "  context 0x" << std::hex << top[i].context << std::dec
+                      << ": " << top[i].hits << "/" << top[i].predictions << " hits\n";
+        }
+    }).join();
+
+    std::cout << "First-order hit rate: " << first_order.rate() << "%\n";
+    std::cout << "Tagged hit rate:      " << contextual.rate() << "%\n";
+    if (contextual.rate() < 90.0 || first_order.rate() > 90.0) {
+        std::cout << "FAILED: call-site tags should predict the interleaved streams\n";
+        return 1;
+    }
+
+    std::cout << "Test completed successfully\n";
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+std::vector<void*> fill(size_t n, size_t size) {
+    std::vector<void*> blocks(n);
+    for (size_t i = 0; i < n; ++i) {
+        blocks[i] = allocate(size);
+        std::memset(blocks[i], static_cast<int>(i), size);
+    }
+    return blocks;
+}
+
+int main() {
+    std::cout << "=== Deferred Coalescing Test ===\n";
+    bool ok = true;
+
+    // Frees go straight to the shards rather than the pools
+    set_cache_budget(0);
+    set_deferred_coalescing(true);
+
+    constexpr size_t N = 2000;
+    std::vector<void*> blocks = fill(N, 1000);
+    HeapStats before = get_heap_stats();
+    for (void* p : blocks) deallocate(p);
+    HeapStats freed = get_heap_stats();
+    std::cout << "  parked " << freed.parked_bytes << " bytes, " << freed.coalesces - before.coalesces
+              << " merges\n";
+    ok &= check(freed.parked_bytes > 0, "freed blocks are parked");
+    ok &= check(freed.coalesces > before.coalesces, "parked blocks are merged in batches as frees go on");
+
+    blocks = fill(N, 1000);
+    HeapStats refilled = get_heap_stats();
+    ok &= check(refilled.mapped_bytes == freed.mapped_bytes, "parked and merged blocks are reused");
+    bool intact = true;
+    for (size_t i = 0; i < N; ++i) intact &= static_cast<unsigned char*>(blocks[i])[999] == static_cast<unsigned char>(i);
+    ok &= check(intact, "reused blocks do not overlap");
+    for (void* p : blocks) deallocate(p);
+
+    coalesce_clean();
+    ok &= check(get_heap_stats().parked_bytes == 0, "coalesce_clean merges every parked block");
+
+    // With the background thread running, request threads leave the merging
+    // to it
+    ok &= check(start_background_coalescing(1), "the background thread starts");
+    ok &= check(!start_background_coalescing(1), "only one background thread runs");
+    blocks = fill(N / 4, 500);
+    for (void* p : blocks) deallocate(p);
+    ok &= check(get_heap_stats().parked_bytes > 0, "frees still park");
+    bool drained = false;
+    for (int i = 0; i < 1000 && !drained; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        drained = get_heap_stats().parked_bytes == 0;
+    }
+    ok &= check(drained, "the background thread merges parked blocks");
+    stop_background_coalescing();
+
+    blocks = fill(N / 4, 500);
+    for (void* p : blocks) deallocate(p);
+    set_deferred_coalescing(false);
+    ok &= check(get_heap_stats().parked_bytes == 0, "turning deferral off merges what is parked");
+
+    return finish(ok);
+}
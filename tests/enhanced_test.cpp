@@ -79,7 +79,7 @@ void test_enhanced_caching() {
 
 int main() {
     std::cout << "=== Enhanced Markov Allocator Tests ===\n";
-    std::cout << "Features: Eigen3-based prediction, enhanced caching, smart coalescing\n\n";
+    std::cout << "Features: integer Markov prediction, predictive pools, smart coalescing\n\n";
     
     initHeap();
     
@@ -88,7 +88,7 @@ int main() {
     
     std::cout << "\n=== All enhanced tests completed ===\n";
     std::cout << "The allocator now features:\n";
-    std::cout << "- Advanced Eigen3-based Markov prediction\n";
+    std::cout << "- O(1) integer-count Markov prediction\n";
     std::cout << "- Enhanced caching with block splitting\n";
     std::cout << "- Adjacent block caching\n";
     std::cout << "- Smart coalescing that preserves cache opportunities\n";
@@ -0,0 +1,101 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+constexpr size_t MB = 1 << 20;
+
+int main() {
+    std::cout << "=== Huge Allocation Test ===\n";
+    bool ok = true;
+
+    // A huge block's mapping starts a little before its payload, on a 2 MB
+    // boundary once it spans a huge page
+    char* big = static_cast<char*>(allocate(8 * MB));
+    ok &= check(big != nullptr && reinterpret_cast<uintptr_t>(big) % (2 * MB) < 4096, "a huge block is 2 MB aligned");
+    std::memset(big, 'h', 8 * MB);
+    HeapStats held = get_heap_stats();
+    ok &= check(held.bytes_in_use >= 8 * MB && held.mapped_bytes >= 8 * MB, "a huge block is counted as in use and mapped");
+
+    // Freeing keeps the mapping for the next request of a similar size
+    deallocate(big);
+    HeapStats freed = get_heap_stats();
+    ok &= check(freed.bytes_in_use + 8 * MB <= held.bytes_in_use, "a freed huge block is no longer in use");
+    char* again = static_cast<char*>(allocate(7 * MB));
+    ok &= check(again == big, "a freed mapping is reused from the cache");
+    ok &= check(get_heap_stats().mapped_bytes == freed.mapped_bytes, "reuse maps nothing new");
+    deallocate(again);
+
+    // Too small a request for a cached mapping gets its own
+    char* small = static_cast<char*>(allocate(MB));
+    ok &= check(small != nullptr && small != big, "a much smaller request does not take a large cached mapping");
+    deallocate(small);
+
+    // Churn from several threads, including frees of other threads' blocks
+    std::vector<void*> handed(64);
+    bool intact[4] = {true, true, true, true};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 200; ++i) {
+                size_t size = (1 + (i + t) % 5) * MB;
+                char* p = static_cast<char*>(allocate(size));
+                p[0] = static_cast<char>(t);
+                p[size - 1] = static_cast<char>(i);
+                intact[t] &= p[0] == static_cast<char>(t) && p[size - 1] == static_cast<char>(i);
+                if (i % 4 == 0) {
+                    void*& slot = handed[t * 16 + i / 4 % 16];
+                    deallocate(slot);
+                    slot = p;
+                } else {
+                    deallocate(p);
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+    for (void* p : handed) deallocate(p);
+    ok &= check(intact[0] && intact[1] && intact[2] && intact[3], "huge blocks churn across threads");
+
+    // Under a raised threshold mid-sized blocks come from the arenas again
+    set_huge_threshold(16 * MB);
+    HeapStats before = get_heap_stats();
+    char* mid = static_cast<char*>(allocate(600 * 1024));
+    size_t mapped = get_heap_stats().mapped_bytes - before.mapped_bytes;
+    ok &= check(mid != nullptr && (mapped == 0 || mapped == MB), "a raised threshold keeps blocks in arenas");
+    deallocate(mid);
+    set_huge_threshold(0);
+    void* lowered = allocate(300 * 1024);
+    ok &= check(lowered != nullptr, "the threshold never drops below the largest size class");
+    deallocate(lowered);
+
+    // Resizing within a huge block stays put, and growing far past it moves
+    char* grown = static_cast<char*>(allocate(4 * MB));
+    std::memset(grown, 'g', 4 * MB);
+    ok &= check(reallocate(grown, 3 * MB) == grown, "a huge block shrinks in place");
+    char* moved = static_cast<char*>(reallocate(grown, 32 * MB));
+    ok &= check(moved != nullptr && moved[3 * MB - 1] == 'g', "a huge block grows by moving");
+    deallocate(moved);
+
+    void* aligned = aligned_allocate(3 * MB, 64 * 1024);
+    ok &= check(aligned != nullptr && reinterpret_cast<uintptr_t>(aligned) % (64 * 1024) == 0,
+                "aligned huge requests are honoured");
+    deallocate(aligned);
+
+    // A batch of huge blocks is mapped block by block
+    void* batch[4];
+    HeapStats pre = get_heap_stats();
+    size_t got = allocate_batch(2 * MB, 4, batch);
+    bool distinct = got == 4;
+    for (size_t i = 0; i < got; ++i) {
+        std::memset(batch[i], static_cast<int>(i), 2 * MB);
+        for (size_t j = 0; j < i; ++j) distinct &= batch[i] != batch[j];
+    }
+    ok &= check(distinct && get_heap_stats().bytes_in_use - pre.bytes_in_use >= 8 * MB, "allocate_batch maps huge blocks");
+    deallocate_batch(batch, got);
+
+    return finish(ok);
+}
@@ -0,0 +1,91 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.h"
+
+// Built without the allocator and run under
+//   LD_PRELOAD=build/libmarkov_preload.so
+// so malloc and operator new here only reach the heap through interposition.
+
+// Whether the definition the dynamic linker binds name to is the preload
+// library's
+bool interposed(const char* name) {
+    Dl_info info;
+    void* sym = dlsym(RTLD_DEFAULT, name);
+    return sym != nullptr && dladdr(sym, &info) != 0 && std::strstr(info.dli_fname, "libmarkov_preload") != nullptr;
+}
+
+int main() {
+    std::cout << "=== Interpose Test ===\n";
+    bool ok = true;
+
+    ok &= check(interposed("malloc") && interposed("free") && interposed("realloc"), "the C functions come from the preload library");
+    ok &= check(interposed("_Znwm") && interposed("_ZdlPv"), "operator new and delete come from the preload library");
+
+    // Containers built on several threads and torn down on another
+    std::vector<std::map<int, std::string>*> built;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 50; ++round) {
+                auto* m = new std::map<int, std::string>;
+                for (int i = 0; i < 200; ++i) (*m)[i] = std::string(1 + (i * 7 + t) % 500, char('a' + i % 26));
+                std::lock_guard<std::mutex> guard(lock);
+                built.push_back(m);
+            }
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    bool intact = built.size() == 200;
+    std::thread([&] {
+        for (auto* m : built) {
+            for (auto& [i, s] : *m) intact &= s.find_first_not_of(char('a' + i % 26)) == std::string::npos;
+            delete m;
+        }
+    }).join();
+    ok &= check(intact, "containers survive being freed on another thread");
+
+    // A buffer grown by realloc keeps what was written
+    char* text = nullptr;
+    size_t len = 0;
+    for (int i = 0; i < 5000; ++i) {
+        text = static_cast<char*>(realloc(text, len + 2));
+        text[len++] = char('a' + i % 26);
+        text[len] = '\0';
+    }
+    bool grown = true;
+    for (size_t i = 0; i < len; ++i) grown &= text[i] == char('a' + i % 26);
+    free(text);
+    ok &= check(grown, "realloc keeps contents while growing");
+
+    // posix_memalign rejects alignments that are not a power-of-two multiple
+    // of sizeof(void*), zero included
+    void* p = nullptr;
+    ok &= check(posix_memalign(&p, 0, 100) == EINVAL && posix_memalign(&p, 24, 100) == EINVAL && p == nullptr,
+                "posix_memalign rejects a zero or odd alignment");
+    ok &= check(posix_memalign(&p, 64, 100) == 0 && reinterpret_cast<uintptr_t>(p) % 64 == 0, "posix_memalign aligns");
+    free(p);
+
+    // The child of a fork can allocate
+    pid_t child = fork();
+    if (child == 0) {
+        std::vector<std::string> strings(1000, std::string(100, 'x'));
+        _exit(strings.back().size() == 100 ? 0 : 1);
+    }
+    int status = 0;
+    ok &= check(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                "a forked child allocates");
+
+    return finish(ok);
+}
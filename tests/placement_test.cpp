@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+constexpr size_t KB = 1024;
+
+// Frees two blocks of different sizes in the same bin, separated by live
+// blocks so they cannot merge, and returns which of them a request smaller
+// than both gets.
+char* pick_between(char*& low, char*& high, size_t low_size, size_t high_size, size_t request) {
+    low = static_cast<char*>(allocate(low_size));
+    void* fence1 = allocate(1000);
+    high = static_cast<char*>(allocate(high_size));
+    void* fence2 = allocate(1000);
+    deallocate(low);
+    deallocate(high);
+    coalesce_clean();  // hands the queued frees to the shard
+    char* got = static_cast<char*>(allocate(request));
+    deallocate(got);
+    deallocate(fence1);
+    deallocate(fence2);
+    coalesce_clean();
+    return got;
+}
+
+// Random churn with a content check; returns false on any overlap. `end` gets
+// the heap as the churn leaves it, before the survivors are freed.
+bool churn(std::mt19937& rng, HeapStats& end) {
+    std::vector<std::pair<char*, size_t>> live;
+    for (int i = 0; i < 20000; ++i) {
+        if (live.empty() || rng() % 3 != 0) {
+            size_t size = 1 + rng() % (rng() % 20 == 0 ? 200000 : 2000);
+            char* p = static_cast<char*>(allocate(size));
+            if (p == nullptr) return false;
+            std::memset(p, static_cast<int>(size), size);
+            live.push_back({p, size});
+        } else {
+            size_t k = rng() % live.size();
+            auto [p, size] = live[k];
+            for (size_t j = 0; j < size; j += 97) {
+                if (static_cast<unsigned char>(p[j]) != static_cast<unsigned char>(size)) return false;
+            }
+            deallocate(p);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    end = get_heap_stats();
+    for (auto [p, size] : live) deallocate(p);
+    return true;
+}
+
+int main() {
+    std::cout << "=== Placement Policy Test ===\n";
+    bool ok = true;
+
+    // Frees go straight to the shards rather than the pools
+    set_cache_budget(0);
+
+    // 260 KB and 300 KB blocks share the bin below a 258 KB request's
+    char *low, *high;
+    set_placement_policy(PlacementPolicy::BestFit);
+    char* got = pick_between(low, high, 260 * KB, 300 * KB, 258 * KB);
+    ok &= check(got == low, "best fit takes the smallest block that fits");
+    got = pick_between(low, high, 300 * KB, 260 * KB, 258 * KB);
+    ok &= check(got == high, "best fit does not depend on address");
+
+    set_placement_policy(PlacementPolicy::AddressOrdered);
+    got = pick_between(low, high, 300 * KB, 260 * KB, 258 * KB);
+    ok &= check(got <= low, "address order takes the lowest block that fits");
+
+    const PlacementPolicy policies[] = {PlacementPolicy::SegregatedFit, PlacementPolicy::BestFit,
+                                        PlacementPolicy::AddressOrdered};
+    const char* names[] = {"segregated", "best fit", "address order"};
+    std::mt19937 rng(7);
+    bool intact = true;
+    for (int i = 0; i < 3; ++i) {
+        set_placement_policy(policies[i]);
+        HeapStats s;
+        intact &= churn(rng, s);
+        coalesce_clean();
+        std::cout << "  " << names[i] << ": " << s.free_fragments << " free fragments, " << s.free_bytes / KB
+                  << " KB free, largest " << s.largest_free_block / KB << " KB\n";
+    }
+    ok &= check(intact, "every policy keeps blocks apart");
+
+    set_placement_policy(PlacementPolicy::SegregatedFit);
+    return finish(ok);
+}
@@ -0,0 +1,89 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <malloc.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+// Linked together with src/preload.cpp, so malloc, free and operator new in
+// this program are the allocator's.
+
+bool aligned(const void* p, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+struct alignas(64) CacheLine {
+    char bytes[64];
+};
+
+int main() {
+    std::cout << "=== Preload Test ===\n";
+    bool ok = true;
+    HeapStats before = get_heap_stats();
+
+    bool all_aligned = true;
+    std::vector<void*> blocks;
+    for (size_t size = 1; size < 2000; size += 7) {
+        void* p = malloc(size);
+        all_aligned &= p != nullptr && aligned(p, alignof(max_align_t)) && malloc_usable_size(p) >= size;
+        std::memset(p, 0xab, size);
+        blocks.push_back(p);
+    }
+    for (void* p : blocks) free(p);
+    ok &= check(all_aligned, "malloc returns max_align_t aligned blocks of the usable size");
+    ok &= check(get_heap_stats().allocations - before.allocations >= blocks.size(), "malloc goes through the heap");
+
+    unsigned char* zeroed = static_cast<unsigned char*>(calloc(100, 10));
+    bool all_zero = zeroed != nullptr;
+    for (int i = 0; i < 1000 && all_zero; ++i) all_zero = zeroed[i] == 0;
+    ok &= check(all_zero, "calloc zeroes");
+    free(zeroed);
+    volatile size_t huge = SIZE_MAX / 2;
+    ok &= check(calloc(huge, 4) == nullptr, "calloc detects overflow");
+
+    char* grown = static_cast<char*>(malloc(16));
+    std::strcpy(grown, "markov");
+    grown = static_cast<char*>(realloc(grown, 4000));
+    ok &= check(grown != nullptr && std::strcmp(grown, "markov") == 0, "realloc keeps contents");
+    free(grown);
+
+    void* p = nullptr;
+    ok &= check(posix_memalign(&p, 256, 100) == 0 && aligned(p, 256) && malloc_usable_size(p) >= 100, "posix_memalign");
+    free(p);
+    ok &= check(posix_memalign(&p, 24, 100) != 0, "posix_memalign rejects bad alignment");
+    p = aligned_alloc(4096, 5000);
+    ok &= check(p != nullptr && aligned(p, 4096), "aligned_alloc");
+    free(p);
+
+    auto line = std::make_unique<CacheLine[]>(10);
+    ok &= check(aligned(line.get(), 64), "aligned operator new[]");
+    line.reset();
+
+    // Containers on several threads, freed on other threads
+    std::vector<std::string*> handed;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 1000; ++i) {
+                auto* s = new std::string(20 + (i + t) % 300, 'x');
+                std::lock_guard<std::mutex> guard(lock);
+                handed.push_back(s);
+            }
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    bool intact = handed.size() == 4000;
+    for (std::string* s : handed) {
+        intact &= s->find_first_not_of('x') == std::string::npos;
+        delete s;
+    }
+    ok &= check(intact, "operator new/delete across threads");
+
+    return finish(ok);
+}
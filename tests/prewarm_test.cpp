@@ -0,0 +1,49 @@
+#include <cstring>
+#include <iostream>
+#include "heap.h"
+#include "check.h"
+
+// A pattern whose classes come back at different distances: 16 and 32 byte
+// requests twice a round, the rest once
+const size_t pattern[] = {16, 32, 64, 24, 100, 8, 48, 256};
+constexpr int N = sizeof pattern / sizeof pattern[0];
+
+// Allocates a round of the pattern, then frees it; returns false if blocks
+// overlap
+bool round_trip() {
+    char* live[N];
+    for (int i = 0; i < N; ++i) {
+        live[i] = static_cast<char*>(allocate(pattern[i]));
+        std::memset(live[i], i, pattern[i]);
+    }
+    bool intact = true;
+    for (int i = 0; i < N; ++i) {
+        intact &= live[i][0] == i && live[i][pattern[i] - 1] == i;
+        deallocate(live[i]);
+    }
+    return intact;
+}
+
+uint64_t total_misses(const HeapStats& s) {
+    uint64_t misses = 0;
+    for (int c = 0; c < STATS_CLASSES; ++c) misses += s.cache_misses[c];
+    return misses;
+}
+
+int main() {
+    std::cout << "=== Pre-warm Test ===\n";
+    bool ok = true;
+
+    bool intact = true;
+    for (int round = 0; round < 100; ++round) intact &= round_trip();
+    HeapStats warm = get_heap_stats();
+    for (int round = 0; round < 1000; ++round) intact &= round_trip();
+    HeapStats s = get_heap_stats();
+
+    uint64_t misses = total_misses(s) - total_misses(warm);
+    std::cout << "  " << misses << " misses in " << 1000 * N << " allocations\n";
+    ok &= check(intact, "pre-carved blocks do not overlap");
+    ok &= check(misses < 1000 * N / 100, "classes further ahead than the next one are kept in the pools");
+
+    return finish(ok);
+}
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "MarkovPredictor.h"
+#include "heap.h"
+#include "check.h"
+
+// Overwrites size bytes of the file at offset
+void patch(const char* path, long offset, const void* data, size_t size) {
+    FILE* f = fopen(path, "r+b");
+    fseek(f, offset, SEEK_SET);
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+bool same_predictions(const MarkovPredictor& a, const MarkovPredictor& b) {
+    for (int from = 0; from < MarkovPredictor::MATRIX_SIZE; ++from) {
+        int sa[4], sb[4];
+        float pa[4], pb[4];
+        int n = a.predict_top(from, 4, sa, pa);
+        if (b.predict_top(from, 4, sb, pb) != n) return false;
+        for (int i = 0; i < n; ++i) {
+            if (sa[i] != sb[i] || pa[i] != pb[i]) return false;
+        }
+    }
+    return true;
+}
+
+// Prediction hits on a fresh thread running a short repeating pattern
+uint64_t fresh_thread_hits() {
+    HeapStats before = get_heap_stats();
+    std::thread([] {
+        for (int round = 0; round < 5; ++round) {
+            void* a = allocate(40);
+            void* b = allocate(200);
+            void* c = allocate(1000);
+            deallocate(a);
+            deallocate(b);
+            deallocate(c);
+        }
+    }).join();
+    return get_heap_stats().prediction_hits - before.prediction_hits;
+}
+
+int main() {
+    std::cout << "=== Profile Test ===\n";
+    bool ok = true;
+
+    char path[] = "/tmp/markov_profile_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return finish(false);
+    close(fd);
+
+    // A predictor's counts survive a round trip. Each row has a clear
+    // favourite, two steps on, and a runner-up.
+    MarkovPredictor trained;
+    for (int i = 0; i < 3000; ++i) trained.update(i % 7, i % 7 + (i % 3 == 0 ? 1 : 2));
+    ok &= check(trained.save(path), "a snapshot is written");
+    MarkovPredictor restored;
+    ok &= check(restored.load(path) && same_predictions(trained, restored), "a loaded snapshot predicts the same");
+    MarkovPredictor saturating(16);
+    ok &= check(saturating.load(path) && saturating.predict(3) == 5, "counts over the saturation limit are scaled down");
+
+    // Snapshots that do not match are refused
+    ok &= check(!restored.load("/nonexistent/profile"), "a missing file is refused");
+    BasicMarkovPredictor<PowerOfTwoClasses> other_map;
+    char other[] = "/tmp/markov_profile_other_XXXXXX";
+    close(mkstemp(other));
+    other_map.save(other);
+    ok &= check(!restored.load(other) && !load_prediction_profile(other), "a snapshot of another class map is refused");
+    unlink(other);
+    uint32_t version = MarkovPredictor::SNAPSHOT_VERSION + 1;
+    patch(path, 8, &version, sizeof version);
+    ok &= check(!restored.load(path) && same_predictions(trained, restored), "another version is refused and changes nothing");
+    truncate(path, MarkovPredictor::SNAPSHOT_SIZE / 2);
+    ok &= check(!restored.load(path) && !load_prediction_profile(path), "a short file is refused");
+
+    // A profile of this thread's pattern starts new threads warm
+    for (int round = 0; round < 1000; ++round) {
+        void* a = allocate(40);
+        void* b = allocate(200);
+        void* c = allocate(1000);
+        deallocate(a);
+        deallocate(b);
+        deallocate(c);
+    }
+    ok &= check(save_prediction_profile(path), "the thread's model is saved");
+    uint64_t cold = fresh_thread_hits();
+    ok &= check(load_prediction_profile(path), "the profile is loaded");
+    uint64_t warm = fresh_thread_hits();
+    std::cout << "  " << cold << " correct predictions cold, " << warm << " warm\n";
+    ok &= check(warm > cold, "new threads predict from the profile");
+    unlink(path);
+
+    return finish(ok);
+}
@@ -0,0 +1,73 @@
+#include <cstring>
+#include <iostream>
+#include "heap.h"
+#include "check.h"
+
+// Fills a buffer with a pattern derived from its size so a copy can be checked
+void fill(char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) p[i] = static_cast<char>(i * 31 + 7);
+}
+
+bool intact(const char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] != static_cast<char>(i * 31 + 7)) return false;
+    }
+    return true;
+}
+
+int main() {
+    std::cout << "=== Realloc Test ===\n";
+    bool ok = true;
+
+    // On a fresh shard the first block is carved from the front of the arena,
+    // so the rest of the arena is the free block right after it
+    char* a = static_cast<char*>(allocate(1000));
+    fill(a, 1000);
+    HeapStats before = get_heap_stats();
+    char* grown = static_cast<char*>(reallocate(a, 3000));
+    HeapStats after = get_heap_stats();
+    ok &= check(grown == a && intact(grown, 1000), "grows in place into the following free block");
+    ok &= check(after.bytes_in_use - before.bytes_in_use >= 2000, "growth counts towards bytes in use");
+    ok &= check(after.predictions == before.predictions && after.allocations == before.allocations,
+                "the predictor does not see the resize");
+
+    // b is carved right after a, so a can no longer grow in place
+    char* b = static_cast<char*>(allocate(1000));
+    fill(grown, 3000);
+    char* moved = static_cast<char*>(reallocate(grown, 6000));
+    ok &= check(moved != nullptr && moved != grown && intact(moved, 3000), "moves and copies when the next block is in use");
+
+    fill(b, 1000);
+    before = get_heap_stats();
+    char* shrunk = static_cast<char*>(reallocate(b, 100));
+    after = get_heap_stats();
+    ok &= check(shrunk == b && intact(shrunk, 100), "shrinks in place");
+    ok &= check(before.bytes_in_use - after.bytes_in_use >= 800, "the split-off tail is freed");
+    ok &= check(reallocate(shrunk, 900) == b && intact(b, 100), "grows back into the split-off tail");
+
+    // A buffer grown the way vectors grow, into an oversized arena and back
+    size_t size = 16;
+    char* buf = static_cast<char*>(allocate(size));
+    fill(buf, size);
+    bool kept = true;
+    while (size < 4 * 1024 * 1024) {
+        size_t next = size + size / 2;
+        buf = static_cast<char*>(reallocate(buf, next));
+        kept &= buf != nullptr && intact(buf, size);
+        fill(buf, next);
+        size = next;
+    }
+    buf = static_cast<char*>(reallocate(buf, 64));
+    kept &= buf != nullptr && intact(buf, 64);
+    ok &= check(kept, "contents survive growing to 4 MB and shrinking back");
+
+    char* fresh = static_cast<char*>(reallocate(nullptr, 40));
+    ok &= check(fresh != nullptr, "a null pointer allocates");
+    ok &= check(reallocate(fresh, 0) == nullptr, "a size of 0 frees");
+
+    deallocate(buf);
+    deallocate(moved);
+    deallocate(b);
+
+    return finish(ok);
+}
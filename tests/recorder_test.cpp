@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "PredictionModel.h"
+#include "heap.h"
+#include "recorder.h"
+
+constexpr int THREADS = 4;
+constexpr int ROUNDS = 3000;  // enough to fill and hand off several buffers
+
+void worker() {
+    size_t sizes[] = {16, 48, 200};
+    for (int round = 0; round < ROUNDS; ++round) {
+        void* p = allocate(sizes[round % 3]);
+        deallocate(p);
+    }
+}
+
+// A tagged, repeating pattern on one thread, at order 2, for comparing the
+// heap's prediction counts with a PredictionModel stepped over its trace
+void patterned() {
+    size_t sizes[] = {16, 48, 200, 16, 3000, 48, 200};
+    for (int round = 0; round < ROUNDS; ++round) {
+        void* p = allocate(sizes[round % 7], round % 5 == 0 ? 7 : 0);
+        deallocate(p);
+    }
+}
+
+int main() {
+    std::cout << "=== Recorder Test ===\n";
+    char path[] = "/tmp/markov_recorder_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    close(fd);
+
+    void* before = allocate(64);  // freed during the recording, unmatched
+    if (!record_start(path)) {
+        std::cout << "FAILED: could not start recording\n";
+        return 1;
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; ++i) threads.emplace_back(worker);
+    for (std::thread& t : threads) t.join();
+    deallocate(before);
+    record_stop();
+    allocate(32);  // not recorded
+
+    FILE* f = fopen(path, "rb");
+    RecordFileHeader header;
+    bool ok = f != nullptr && fread(&header, sizeof header, 1, f) == 1
+              && std::memcmp(header.magic, RECORD_MAGIC, sizeof header.magic) == 0;
+
+    size_t allocs = 0, frees = 0, bad_sizes = 0;
+    AllocRecord r;
+    while (ok && fread(&r, sizeof r, 1, f) == 1) {
+        if (r.op == RecordOp::Allocate) {
+            ++allocs;
+            if (r.size != 16 && r.size != 48 && r.size != 200) ++bad_sizes;
+        } else {
+            ++frees;
+        }
+    }
+    if (f != nullptr) fclose(f);
+    unlink(path);
+
+    std::cout << "Recorded " << allocs << " allocations and " << frees << " frees\n";
+    if (!ok || allocs != THREADS * ROUNDS || frees != THREADS * ROUNDS + 1 || bad_sizes != 0) {
+        std::cout << "FAILED: expected " << THREADS * ROUNDS << " allocations and " << THREADS * ROUNDS + 1 << " frees\n";
+        return 1;
+    }
+
+    // The predictor mode of tools/replay.cpp steps the same model the heap
+    // does, so on a recorded trace it must count what the heap counted
+    std::strcpy(path, "/tmp/markov_recorder_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) return 1;
+    close(fd);
+    set_predictor_order(2);
+    HeapStats before_stats = get_heap_stats();
+    if (!record_start(path)) {
+        std::cout << "FAILED: could not start recording\n";
+        return 1;
+    }
+    std::thread(patterned).join();
+    record_stop();
+    HeapStats after_stats = get_heap_stats();
+    set_predictor_order(1);
+
+    PredictionModel model;
+    uint64_t predictions = 0, hits = 0;
+    f = fopen(path, "rb");
+    ok = f != nullptr && fread(&header, sizeof header, 1, f) == 1;
+    while (ok && fread(&r, sizeof r, 1, f) == 1) {
+        if (r.op != RecordOp::Allocate) continue;
+        int c = DefaultSizeClasses::class_of(r.size <= 64 ? r.size : r.size + sizeof(size_t));
+        Prediction predicted = model.predict();
+        if (predicted.state != -1) {
+            ++predictions;
+            hits += predicted.state == c;
+        }
+        model.observe(c, 2, r.ctx);
+    }
+    if (f != nullptr) fclose(f);
+    unlink(path);
+
+    uint64_t heap_predictions = after_stats.predictions - before_stats.predictions;
+    uint64_t heap_hits = after_stats.prediction_hits - before_stats.prediction_hits;
+    std::cout << "Replayed " << hits << "/" << predictions << " hits, heap counted " << heap_hits << "/"
+              << heap_predictions << "\n";
+    if (!ok || predictions != ROUNDS - 1 || predictions != heap_predictions || hits != heap_hits) {
+        std::cout << "FAILED: the replayed model should count what the heap counted\n";
+        return 1;
+    }
+    std::cout << "Test completed successfully\n";
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "region.h"
+#include "check.h"
+
+bool aligned(const void* p, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+constexpr int THREADS = 4;
+constexpr int PER_THREAD = 20000;
+
+int main() {
+    std::cout << "=== Region Test ===\n";
+    bool ok = true;
+    HeapStats start = get_heap_stats();
+
+    {
+        Region region;
+        char* first = static_cast<char*>(region.allocate(24));
+        char* second = static_cast<char*>(region.allocate(24));
+        ok &= check(first != nullptr && second == first + 32, "allocations are bumped back to back without headers");
+
+        bool all_aligned = true;
+        for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+            all_aligned &= aligned(region.allocate(7, alignment), std::max<size_t>(alignment, 16));
+        }
+        ok &= check(all_aligned, "alignments up to 4096");
+
+        void* big = region.allocate(1 << 20);
+        ok &= check(big != nullptr && region.chunk_bytes() > (1 << 20), "large requests get a chunk of their own");
+        std::memset(big, 1, 1 << 20);
+        void* after_big = region.allocate(24);
+        ok &= check(static_cast<char*>(after_big) < first + Region::DEFAULT_CHUNK_SIZE,
+                    "a large request leaves the current chunk in use");
+
+        for (int i = 0; i < 10000; ++i) region.allocate(64);
+        size_t grown = region.chunk_bytes();
+        region.reset();
+        ok &= check(region.chunk_bytes() < grown && region.chunk_bytes() == Region::DEFAULT_CHUNK_SIZE,
+                    "reset keeps one chunk and returns the rest");
+        char* again = static_cast<char*>(region.allocate(24));
+        ok &= check(again != nullptr && region.chunk_bytes() == Region::DEFAULT_CHUNK_SIZE, "the kept chunk is reused");
+        ok &= check(region.allocate(8, 3) == nullptr, "bad alignments are rejected");
+
+        // Threads bump the same region; every object keeps its own pattern
+        std::vector<std::vector<uint32_t*>> objects(THREADS);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < PER_THREAD; ++i) {
+                    uint32_t* p = static_cast<uint32_t*>(region.allocate(4 * sizeof(uint32_t)));
+                    for (int w = 0; w < 4; ++w) p[w] = static_cast<uint32_t>(t * PER_THREAD + i);
+                    objects[t].push_back(p);
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+        bool intact = true;
+        for (int t = 0; t < THREADS; ++t) {
+            for (int i = 0; i < PER_THREAD; ++i) {
+                for (int w = 0; w < 4; ++w) intact &= objects[t][i][w] == static_cast<uint32_t>(t * PER_THREAD + i);
+            }
+        }
+        ok &= check(intact, "concurrent allocations never overlap");
+
+        region.reset();
+        RegionResource resource(region);
+        std::pmr::vector<std::pmr::string> words(&resource);
+        for (int i = 0; i < 1000; ++i) words.emplace_back(std::to_string(i) + " is a number long enough to need a buffer");
+        ok &= check(words.size() == 1000 && words[999].compare(0, 4, "999 ") == 0, "pmr containers allocate from the region");
+    }
+
+    coalesce_clean();
+    ok &= check(get_heap_stats().bytes_in_use == start.bytes_in_use, "destroying the region returns every chunk");
+
+    return finish(ok);
+}
@@ -0,0 +1,85 @@
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "resource.h"
+#include "check.h"
+
+// Fraction of next-class predictions that were right, over all contexts
+double hit_rate(const PredictionModel* model) {
+    ContextHitRate rates[256];
+    size_t n = context_hit_rates(rates, 256, model);
+    uint64_t predictions = 0, hits = 0;
+    for (size_t i = 0; i < n; ++i) {
+        predictions += rates[i].predictions;
+        hits += rates[i].hits;
+    }
+    return predictions > 0 ? static_cast<double>(hits) / predictions : 0;
+}
+
+// Two maps with different node sizes filled in a pseudo-random interleaving.
+// Through one model the next node size is a coin flip; with a model per map
+// each stream is a single class repeating.
+void fill_maps(MarkovMemoryResource& small_nodes, MarkovMemoryResource& large_nodes) {
+    std::pmr::map<int, int> small(&small_nodes);
+    std::pmr::map<int, std::array<char, 100>> large(&large_nodes);
+    uint32_t seed = 12345;
+    for (int i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        if (seed >> 16 & 1) {
+            small[i] = i;
+        } else {
+            large[i] = {};
+        }
+    }
+}
+
+struct alignas(64) Line {
+    char bytes[64];
+};
+
+int main() {
+    std::cout << "=== Memory Resource Test ===\n";
+    bool ok = true;
+
+    double shared = 0, own_small = 0, own_large = 0;
+    std::thread([&] {
+        MarkovMemoryResource a, b;
+        fill_maps(a, b);
+        shared = hit_rate(nullptr);
+    }).join();
+    std::thread([&] {
+        MarkovMemoryResource a(true), b(true);
+        fill_maps(a, b);
+        own_small = hit_rate(a.model());
+        own_large = hit_rate(b.model());
+    }).join();
+    std::cout << "  hit rate: shared " << shared << ", own " << own_small << " / " << own_large << "\n";
+    ok &= check(own_small > 0.9 && own_large > 0.9, "a resource's own model learns its map's node size");
+    ok &= check(own_small > shared + 0.2 && own_large > shared + 0.2, "separate models beat one shared model");
+
+    MarkovMemoryResource r1, r2(true);
+    ok &= check(r1.is_equal(r2) && !r1.is_equal(*std::pmr::new_delete_resource()),
+                "resources compare equal to each other only");
+    void* p = r2.allocate(100, 256);
+    ok &= check(reinterpret_cast<uintptr_t>(p) % 256 == 0, "over-aligned requests are honoured");
+    r1.deallocate(p, 100, 256);
+
+    std::vector<int, MarkovAllocator<int>> v;
+    for (int i = 0; i < 100000; ++i) v.push_back(i);
+    bool kept = true;
+    for (int i = 0; i < 100000; ++i) kept &= v[i] == i;
+    ok &= check(kept, "a vector grows through MarkovAllocator");
+
+    std::map<int, int, std::less<int>, MarkovAllocator<std::pair<const int, int>>> m{MarkovAllocator<int>(&r2)};
+    for (int i = 0; i < 1000; ++i) m[i] = i * 2;
+    ok &= check(m.size() == 1000 && m[500] == 1000, "a map allocates through a resource");
+
+    std::vector<Line, MarkovAllocator<Line>> lines(10);
+    ok &= check(reinterpret_cast<uintptr_t>(lines.data()) % 64 == 0, "MarkovAllocator keeps over-aligned types aligned");
+
+    return finish(ok);
+}
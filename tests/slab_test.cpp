@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+int main() {
+    std::cout << "=== Slab Test ===\n";
+    bool ok = true;
+
+    // Requests up to 64 bytes take a slot of their size rounded to 16, with
+    // no header
+    bool sized = true;
+    for (size_t size : {1, 8, 16, 24, 32, 48, 64}) {
+        HeapStats before = get_heap_stats();
+        void* p = allocate(size);
+        sized &= get_heap_stats().bytes_in_use - before.bytes_in_use == (size + 15) / 16 * 16;
+        deallocate(p);
+    }
+    ok &= check(sized, "a slot is the request rounded up to 16 bytes");
+
+    constexpr size_t N = 20000;
+    std::vector<void*> small(N);
+    HeapStats before = get_heap_stats();
+    for (size_t i = 0; i < N; ++i) {
+        small[i] = allocate(8 + i % 3 * 8);
+        std::memset(small[i], static_cast<int>(i), 8 + i % 3 * 8);
+    }
+    HeapStats after = get_heap_stats();
+    std::set<void*> distinct(small.begin(), small.end());
+    bool aligned = true, intact = true;
+    for (size_t i = 0; i < N; ++i) {
+        aligned &= reinterpret_cast<uintptr_t>(small[i]) % 16 == 0;
+        intact &= static_cast<unsigned char*>(small[i])[7] == static_cast<unsigned char>(i);
+    }
+    ok &= check(distinct.size() == N && aligned, "slots are distinct and 16-byte aligned");
+    ok &= check(intact, "slots do not overlap");
+    ok &= check(after.mapped_bytes - before.mapped_bytes <= N * 32 * 11 / 10, "slabs pack small objects densely");
+
+    // Half are freed by another thread, which hands them back to their slabs
+    std::thread([&] {
+        for (size_t i = 0; i < N; i += 2) deallocate(small[i]);
+    }).join();
+    for (size_t i = 1; i < N; i += 2) deallocate(small[i]);
+    HeapStats freed = get_heap_stats();
+    ok &= check(freed.bytes_in_use <= before.bytes_in_use, "every slot is returned");
+
+    // A slot grows into a block and shrinks back into a slot
+    char* p = static_cast<char*>(allocate(40));
+    std::memset(p, 'x', 40);
+    ok &= check(reallocate(p, 48) == p, "a slot absorbs growth within its size");
+    char* grown = static_cast<char*>(reallocate(p, 500));
+    ok &= check(grown != nullptr && grown[39] == 'x', "a slot grows into a block");
+    char* shrunk = static_cast<char*>(reallocate(grown, 500));
+    deallocate(shrunk);
+
+    // A repeating small-object pattern is served from the pools, which the
+    // predictor fills from the slabs
+    before = get_heap_stats();
+    for (int round = 0; round < 1000; ++round) {
+        void* a = allocate(16);
+        void* b = allocate(48);
+        void* c = allocate(16);
+        deallocate(a);
+        deallocate(b);
+        deallocate(c);
+    }
+    after = get_heap_stats();
+    uint64_t hits = 0;
+    for (int c = 0; c < STATS_CLASSES; ++c) hits += after.cache_hits[c] - before.cache_hits[c];
+    ok &= check(hits > 2900, "predicted slab classes are pre-warmed");
+
+    return finish(ok);
+}
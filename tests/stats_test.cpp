@@ -0,0 +1,78 @@
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "heap.h"
+#include "check.h"
+
+int main() {
+    std::cout << "=== Stats Test ===\n";
+    HeapStats before = get_heap_stats();
+
+    // A repeating pattern on this thread and on a short-lived one
+    auto work = [] {
+        std::vector<void*> live;
+        for (int round = 0; round < 1000; ++round) {
+            live.push_back(allocate(24));
+            live.push_back(allocate(200));
+            if (round % 2 == 1) {
+                for (void* p : live) deallocate(p);
+                live.clear();
+            }
+        }
+    };
+    work();
+    std::thread(work).join();
+
+    void* held = allocate(5000);
+    HeapStats s = get_heap_stats();
+
+    uint64_t hits = 0, misses = 0;
+    for (int c = 0; c < STATS_CLASSES; ++c) {
+        hits += s.cache_hits[c] - before.cache_hits[c];
+        misses += s.cache_misses[c] - before.cache_misses[c];
+    }
+
+    bool ok = true;
+    ok &= check(s.allocations - before.allocations == 4001, "allocations counted across threads");
+    ok &= check(s.frees - before.frees == 4000, "frees counted across threads");
+    ok &= check(hits + misses == 4001 && hits > 0, "every allocation is a pool hit or miss");
+    ok &= check(s.prediction_hits > before.prediction_hits, "predictor accuracy tracked");
+    ok &= check(s.bytes_in_use >= 5000, "live block counted as in use");
+    ok &= check(s.free_bytes > 0 && s.free_fragments > 0, "free lists counted");
+    ok &= check(s.largest_free_block > 0 && s.largest_free_block <= s.free_bytes, "largest free block within free bytes");
+    ok &= check(s.mapped_bytes >= s.free_bytes, "free bytes within mapped bytes");
+
+    char json[8192];
+    size_t len = heap_stats_json(json, sizeof json);
+    ok &= check(len < sizeof json && json[0] == '{' && json[len - 1] == '}', "JSON dump is one object");
+    ok &= check(std::strstr(json, "\"largest_free_block\":") != nullptr && std::strstr(json, "\"size\":32") != nullptr,
+                "JSON dump has heap and per-class fields");
+    char small[16];
+    ok &= check(heap_stats_json(small, sizeof small) == len && std::strlen(small) == sizeof small - 1,
+                "JSON dump truncates like snprintf");
+
+    std::cout << json << "\n";
+    deallocate(held);
+
+    // Allocated blocks carry only a header, so 120 bytes fit a 128-byte block
+    HeapStats pre = get_heap_stats();
+    void* block = allocate(120);
+    ok &= check(get_heap_stats().bytes_in_use - pre.bytes_in_use == 128, "a block is the request plus an 8-byte header");
+    deallocate(block);
+
+    // Blocks that fill a second arena; once they are freed it stays mapped
+    // for the next round instead of being mapped again
+    auto fill_arenas = [] {
+        std::vector<void*> big(8);
+        for (void*& p : big) p = allocate(200 * 1024);
+        HeapStats full = get_heap_stats();
+        deallocate_batch(big.data(), big.size());
+        return full.mapped_bytes;
+    };
+    size_t mapped = fill_arenas();
+    ok &= check(get_heap_stats().mapped_bytes == mapped, "an emptied arena stays mapped");
+    ok &= check(fill_arenas() == mapped, "the next round reuses it");
+
+    return finish(ok);
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include "heap.h"
+
+constexpr int NUM_THREADS = 8;
+constexpr int ROUNDS = 2000;
+
+std::atomic<int> failures{0};
+
+// Blocks handed from each thread to its neighbour to free
+std::mutex handoff_lock;
+std::vector<std::vector<void*>> handoff(NUM_THREADS);
+
+void worker(int id) {
+    size_t sizes[] = {16, 32, 64, 24, 100, 8};
+    std::vector<void*> mine;
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        size_t size = sizes[round % 6];
+        unsigned char* p = static_cast<unsigned char*>(allocate(size));
+        std::memset(p, id, size);
+        mine.push_back(p);
+
+        // Free every third block locally, after checking nobody overwrote it
+        if (round % 3 == 2) {
+            unsigned char* q = static_cast<unsigned char*>(mine[mine.size() - 2]);
+            size_t qsize = sizes[(round - 1) % 6];
+            for (size_t i = 0; i < qsize; ++i) {
+                if (q[i] != id) {
+                    failures++;
+                    break;
+                }
+            }
+            deallocate(q);
+            mine.erase(mine.end() - 2);
+        }
+    }
+
+    // Give the survivors to the next thread so they are freed cross-thread
+    std::lock_guard<std::mutex> guard(handoff_lock);
+    auto& target = handoff[(id + 1) % NUM_THREADS];
+    target.insert(target.end(), mine.begin(), mine.end());
+}
+
+void drainer(int id) {
+    std::vector<void*> blocks;
+    {
+        std::lock_guard<std::mutex> guard(handoff_lock);
+        blocks.swap(handoff[id]);
+    }
+    for (void* p : blocks) {
+        deallocate(p);
+    }
+}
+
+int main() {
+    std::cout << "=== Multi-threaded Allocator Test ===\n";
+
+    initHeap();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto& t : threads) t.join();
+    threads.clear();
+
+    std::cout << NUM_THREADS << " threads allocated " << ROUNDS << " blocks each\n";
+
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back(drainer, i);
+    }
+    for (auto& t : threads) t.join();
+
+    std::cout << "Survivors freed by neighbouring threads\n";
+
+    if (failures > 0) {
+        std::cout << "FAILED: " << failures << " corrupted blocks\n";
+        return 1;
+    }
+
+    std::cout << "Test completed successfully\n";
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "PredictionModel.h"
+#include "heap.h"
+#include "recorder.h"
+
+// Replays a file written by record_start/record_stop, deterministically and
+// on one thread, in timestamp order. Reallocations are replayed but, as in the
+// heap, are not shown to the predictors.
+//
+//   replay <trace> [--order N] [--threshold T] [--placement P]
+//                                  drive allocate/deallocate
+//   replay <trace> --predictor [--order N] [--threshold T]
+//                                  drive the predictors alone
+//
+// The allocator mode reports per-call latency, the predictor's hit rate as
+// seen by the heap, and how fragmented the heap is when the trace ends. P is
+// segregated, best or address, for set_placement_policy, and T is passed to
+// set_prediction_threshold. The predictor mode steps one PredictionModel per
+// recorded thread, the heap's own, and reports how often it named the next
+// class: all told, as HeapStats counts it for a thread that is pooling (one
+// that is not only samples); when informed, as the heap counts it towards
+// turning pooling back on; and when named with probability at least T, so
+// the pools would have held it.
+
+using Clock = std::chrono::steady_clock;
+
+static bool load(const char* path, std::vector<AllocRecord>& records) {
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) return false;
+
+    RecordFileHeader header;
+    bool ok = fread(&header, sizeof header, 1, f) == 1 && std::memcmp(header.magic, RECORD_MAGIC, sizeof header.magic) == 0
+              && header.version == RECORD_VERSION && header.record_size == sizeof(AllocRecord);
+    AllocRecord record;
+    while (ok && fread(&record, sizeof record, 1, f) == 1) records.push_back(record);
+    fclose(f);
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const AllocRecord& a, const AllocRecord& b) { return a.timestamp < b.timestamp; });
+    return ok;
+}
+
+struct Latency {
+    std::vector<uint32_t> samples;
+
+    void add(Clock::duration d) { samples.push_back(static_cast<uint32_t>(d.count())); }
+
+    void print(const char* name) {
+        if (samples.empty()) return;
+        uint64_t total = 0;
+        for (uint32_t s : samples) total += s;
+        auto pct = [&](double q) {
+            size_t k = static_cast<size_t>(q * (samples.size() - 1));
+            std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+            return samples[k];
+        };
+        printf("%-10s %9zu calls  mean %7.1f ns  p50 %6u ns  p99 %6u ns\n", name, samples.size(),
+               static_cast<double>(total) / samples.size(), pct(0.50), pct(0.99));
+    }
+};
+
+static void replay_allocator(const std::vector<AllocRecord>& records, int order, float threshold) {
+    set_predictor_order(order);
+    set_prediction_threshold(threshold);
+    std::unordered_map<uint64_t, void*> live;  // recorded address -> replayed block
+    live.reserve(records.size());
+    Latency alloc_latency, free_latency, realloc_latency;
+    std::unordered_map<uint16_t, void*> resized;  // thread -> block its last reallocate returned
+    size_t unmatched = 0;
+
+    for (const AllocRecord& r : records) {
+        if (r.op == RecordOp::Allocate) {
+            auto start = Clock::now();
+            void* p = r.align_shift != 0 ? aligned_allocate(r.size, size_t(1) << r.align_shift) : allocate(r.size, r.ctx);
+            alloc_latency.add(Clock::now() - start);
+            if (r.ptr != 0) live[r.ptr] = p;
+        } else if (r.op == RecordOp::ReallocateResult) {
+            // Pairs with the thread's Reallocate, which may be records earlier
+            auto it = resized.find(r.thread);
+            if (it == resized.end()) continue;
+            if (r.ptr != 0 && it->second != nullptr) live[r.ptr] = it->second;
+            resized.erase(it);
+        } else {
+            // Frees of blocks allocated before recording started are skipped
+            auto it = live.find(r.ptr);
+            if (it == live.end()) {
+                ++unmatched;
+                continue;
+            }
+            auto start = Clock::now();
+            if (r.op == RecordOp::Reallocate) {
+                void* p = reallocate(it->second, r.size);
+                realloc_latency.add(Clock::now() - start);
+                if (p == nullptr) continue;
+                resized[r.thread] = p;
+            } else {
+                deallocate(it->second);
+                free_latency.add(Clock::now() - start);
+            }
+            live.erase(it);
+        }
+    }
+    HeapStats end = get_heap_stats();
+    for (auto& [id, p] : live) deallocate(p);
+
+    alloc_latency.print("allocate");
+    free_latency.print("deallocate");
+    realloc_latency.print("reallocate");
+    if (unmatched > 0) printf("skipped %zu frees and reallocations of blocks allocated before recording\n", unmatched);
+    printf("at the end: %zu KB in use, %zu KB free in %zu fragments (largest %zu KB), %zu KB mapped\n",
+           end.bytes_in_use / 1024, end.free_bytes / 1024, end.free_fragments, end.largest_free_block / 1024,
+           end.mapped_bytes / 1024);
+
+    HeapStats stats = get_heap_stats();
+    uint64_t pool_hits = 0;
+    for (int c = 0; c < STATS_CLASSES; ++c) pool_hits += stats.cache_hits[c];
+    if (stats.allocations > 0) printf("pool hit rate %.1f%% over %llu allocations\n", 100.0 * pool_hits / stats.allocations,
+                                      static_cast<unsigned long long>(stats.allocations));
+
+    // First-order rows pack a single class; longer contexts use more bytes
+    ContextHitRate rates[512];
+    size_t n = context_hit_rates(rates, 512);
+    uint64_t predictions[2] = {}, hits[2] = {};
+    for (size_t i = 0; i < n; ++i) {
+        int kind = rates[i].context < 256 ? 0 : 1;
+        predictions[kind] += rates[i].predictions;
+        hits[kind] += rates[i].hits;
+    }
+    const char* names[2] = {"first-order", "context"};
+    for (int kind = 0; kind < 2; ++kind) {
+        if (predictions[kind] == 0) continue;
+        printf("%s hit rate %.1f%% over %llu transitions\n", names[kind], 100.0 * hits[kind] / predictions[kind],
+               static_cast<unsigned long long>(predictions[kind]));
+    }
+}
+
+// Hit and prediction counts of the predictor mode, split as described above
+struct PredictorCounts {
+    uint64_t predictions = 0, hits = 0;
+    uint64_t informed = 0, informed_hits = 0;
+    uint64_t confident = 0, confident_hits = 0;
+};
+
+static void replay_predictor(const std::vector<AllocRecord>& records, int order, float threshold) {
+    std::unordered_map<uint16_t, std::unique_ptr<PredictionModel>> models;
+    Latency latency;
+    PredictorCounts counts;
+
+    for (const AllocRecord& r : records) {
+        if (r.op != RecordOp::Allocate || r.size == 0) continue;
+        std::unique_ptr<PredictionModel>& slot = models[r.thread];
+        if (!slot) slot = std::make_unique<PredictionModel>();
+        PredictionModel& m = *slot;
+        // As in the heap: slab slots up to 64 bytes, blocks with their header above
+        int c = DefaultSizeClasses::class_of(r.size <= 64 ? r.size : r.size + sizeof(size_t));
+
+        auto start = Clock::now();
+        Prediction predicted = m.predict();
+        if (predicted.state != -1) {
+            int state;
+            float prob = 0;
+            bool confident = m.predict_top(1, &state, &prob) == 1 && prob >= threshold;
+            bool hit = predicted.state == c;
+            ++counts.predictions;
+            counts.hits += hit;
+            counts.informed += predicted.informed;
+            counts.informed_hits += predicted.informed && hit;
+            counts.confident += confident;
+            counts.confident_hits += confident && hit;
+        }
+        m.observe(c, order, r.ctx);
+        latency.add(Clock::now() - start);
+    }
+
+    latency.print("predict");
+    if (counts.predictions == 0) return;
+    printf("order-%d hit rate %.1f%% over %llu transitions in %zu threads\n", order,
+           100.0 * counts.hits / counts.predictions, static_cast<unsigned long long>(counts.predictions), models.size());
+    printf("informed: %.1f%% of transitions, %llu hits\n", 100.0 * counts.informed / counts.predictions,
+           static_cast<unsigned long long>(counts.informed_hits));
+    printf("at threshold %.2f: %.1f%% of transitions, %llu hits\n", threshold,
+           100.0 * counts.confident / counts.predictions, static_cast<unsigned long long>(counts.confident_hits));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [--predictor] [--order N] [--threshold T] [--placement segregated|best|address]\n", argv[0]);
+        return 2;
+    }
+    bool predictor_only = false;
+    int order = 1;
+    float threshold = DEFAULT_PREDICTION_THRESHOLD;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--predictor") == 0) {
+            predictor_only = true;
+        } else if (std::strcmp(argv[i], "--order") == 0 && i + 1 < argc) {
+            order = std::clamp(std::atoi(argv[++i]), 1, MAX_PREDICTOR_ORDER);
+        } else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = std::clamp(static_cast<float>(std::atof(argv[++i])), 0.0f, 1.0f);
+        } else if (std::strcmp(argv[i], "--placement") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (std::strcmp(name, "best") == 0) {
+                set_placement_policy(PlacementPolicy::BestFit);
+            } else if (std::strcmp(name, "address") == 0) {
+                set_placement_policy(PlacementPolicy::AddressOrdered);
+            } else if (std::strcmp(name, "segregated") != 0) {
+                fprintf(stderr, "unknown placement %s\n", name);
+                return 2;
+            }
+        }
+    }
+
+    std::vector<AllocRecord> records;
+    if (!load(argv[1], records)) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+    printf("%zu records\n", records.size());
+
+    if (predictor_only) {
+        replay_predictor(records, order, threshold);
+    } else {
+        replay_allocator(records, order, threshold);
+    }
+    return 0;
+}